@@ -0,0 +1,103 @@
+/****************************************************************************
+ * bash_cleanpath.c
+ *
+ * cleanpath as a bash loadable builtin, so a profile can clean PATH
+ * without a subshell, a pipe and an exec for every line:
+ *
+ *     enable -f /path/to/cleanpath.so cleanpath
+ *     cleanpath -Pb -- "$HOME/bin"        # Sets PATH, prints nothing
+ *
+ * Options are exactly those of the cleanpath command (it is the same
+ * check_opt(), from cleanpath.c built with -DCP_BUILTIN).  Instead of
+ * printing, the result is assigned to ENVNAME, which keeps whatever
+ * attributes (export) it already had.  With --noenv, or --stdin, it
+ * prints as the command would.  --batch assigns every group.
+ *
+ * Only built by `make bash-builtin`, which needs the bash headers
+ * (bash-builtins on Debian/Ubuntu, bash-devel elsewhere).
+ *
+ * LICENSE: Same as cleanpath.c
+ */
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "loadables.h"
+
+int     cleanpath_builtin_main( int argc, char *argv[] );
+const char * cp_getvar( const char *name );
+int     cp_setvar( const char *name, const char *value );
+
+/* Called from cleanpath.c for ENVNAME, shell variables need not be
+ * exported to be seen here. */
+const char *
+cp_getvar( const char *name )
+{
+    return get_string_value( name );
+}
+
+int
+cp_setvar( const char *name, const char *value )
+{
+    SHELL_VAR *var = find_variable( name );
+
+    if ( var && ( readonly_p( var ) || noassign_p( var ) ) ) {
+        if ( readonly_p( var ) ) {
+            err_readonly( name );
+        }
+        return 1;
+    }
+    var = bind_variable( name, (char *)value, 0 );
+    if ( !var ) {
+        return 1;
+    }
+    /* So PATH= flushes the command hash, as an assignment would */
+    stupidly_hack_special_variables( (char *)name );
+    return 0;
+}
+
+int
+cleanpath_builtin( WORD_LIST *list )
+{
+    WORD_LIST *word;
+    char **argv;
+    int argc = 1;
+    int ret;
+
+    for ( word = list; word; word = word->next ) {
+        argc++;
+    }
+    argv = (char **)xmalloc( ( argc + 1 ) * sizeof(char *) );
+    argv[0] = "cleanpath";
+    argc = 1;
+    for ( word = list; word; word = word->next ) {
+        argv[argc++] = word->word->word;
+    }
+    argv[argc] = NULL;
+
+    ret = cleanpath_builtin_main( argc, argv );
+    xfree( argv );
+    return ( 0 == ret ) ? EXECUTION_SUCCESS : ret;
+}
+
+char *cleanpath_doc[] = {
+    "Clean a delimited list variable, in place.",
+    "",
+    "Removes duplicate and empty entries of ENVNAME (default PATH), adds",
+    "ENVADD (after, or before with -b), and with -e, -P or -f drops the",
+    "entries that do not exist, are not directories, or are not files.",
+    "The result is assigned to ENVNAME.  See `cleanpath --help' for every",
+    "option.",
+    (char *)NULL
+};
+
+/* What bash looks up by name, everything else in the .so is hidden */
+__attribute__((visibility("default")))
+struct builtin cleanpath_struct = {
+    "cleanpath",
+    cleanpath_builtin,
+    BUILTIN_ENABLED,
+    cleanpath_doc,
+    "cleanpath [-ePfXbS] [-F:] [ [ENVNAME] [--] ENVADD ]",
+    0
+};
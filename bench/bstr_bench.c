@@ -0,0 +1,397 @@
+/****************************************************************************
+ * bench/bstr_bench.c
+ *
+ * Times each bstr.c primitive on its own, over string sizes from 16 B
+ * to 64 MB and over lists of 10 to 1M tokens, for a baseline to judge
+ * allocator or scanning changes against.  Built and run by `make bench`.
+ *
+ *     bstr_bench [-j] [-t MS] [-m MAXBYTES]
+ *         -j  JSON instead of CSV
+ *         -t  Milliseconds to spend on each case (default 100)
+ *         -m  Largest string size to try (default 64M)
+ *
+ * One row per case: ns per op, bytes per second (bytes the op had to
+ * touch), and bstr arena allocations per op.
+ *
+ * LICENSE: Same as cleanpath.c
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "bstr.h"
+#include "bscan.h"
+
+#define TOKLEN 8    // "/t/NNNN:" is about what a PATH entry costs
+
+struct bcase {
+    size_t  n;      // Bytes, or tokens
+    size_t  bytes;  // Bytes one op touches
+    char *  raw;    // n bytes plus NUL
+    bstr *  a;
+    bstr *  b;
+};
+
+typedef void (*bench_fn)( struct bcase *c );
+
+struct {
+    int     json;
+    long    target_ns;
+    size_t  maxbytes;
+    int     rows;
+} bench;
+
+/* Keeps the compiler from dropping results */
+volatile size_t sink;
+
+double
+_now_ns()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ( (double)ts.tv_sec * 1e9 ) + (double)ts.tv_nsec;
+}
+
+void
+_fatal( const char *where )
+{
+    fprintf( stderr, "Fatal: %s(): %s\n", where, strerror(errno) );
+    exit(5);
+}
+
+/****************************************************************************
+ * Size axis, one string of n bytes
+ */
+void
+op_strz_len( struct bcase *c )
+{
+    sink += strz_len( c->raw );
+}
+
+void
+op_strz_len_n( struct bcase *c )
+{
+    sink += strz_len_n( c->raw, c->n + 1 );
+}
+
+void
+op_strz_len_z( struct bcase *c )
+{
+    sink += strz_len_z( c->raw, c->n + 1 );
+}
+
+void
+op_new_bstr( struct bcase *c )
+{
+    bstr *s = new_bstr( c->n );
+    if ( !s ) { _fatal( "new_bstr" ); }
+    sink += s->a;
+    free_bstr( s );
+}
+
+void
+op_catstrz( struct bcase *c )
+{
+    /* From empty, so growth is part of it */
+    bstr *s = new_bstr( 0 );
+    if ( !s ) { _fatal( "new_bstr" ); }
+    bstr_catstrz( s, c->raw, c->n );
+    sink += s->l;
+    free_bstr( s );
+}
+
+void
+op_index( struct bcase *c )
+{
+    /* Not there, so the whole string is scanned */
+    sink += bstr_index( '\001', c->a, 0 );
+}
+
+void
+op_eq( struct bcase *c )
+{
+    sink += bstr_eq( c->a, c->b );
+}
+
+void
+op_splice( struct bcase *c )
+{
+    /* Cut the first byte (moving the rest), then put one back */
+    sink += bstr_splice( c->a, 0, 1, NULL );
+    bstr_catstrz( c->a, "x", 1 );
+}
+
+/****************************************************************************
+ * Token axis, a delimited list of n tokens
+ */
+void
+op_tok_index( struct bcase *c )
+{
+    /* Every delimiter, as the tokenizer does */
+    int start;
+    int end = 0;
+    for ( start = 0; start < c->a->l; start = end + 1 ) {
+        end = bstr_index( ':', c->a, start );
+    }
+    sink += end;
+}
+
+void
+op_tok_catstrz( struct bcase *c )
+{
+    /* Built a token at a time, as ENVADD arguments are */
+    size_t cx;
+    bstr *s = new_bstr( 0 );
+    if ( !s ) { _fatal( "new_bstr" ); }
+    for ( cx = 0; cx < c->n; cx++ ) {
+        bstr_catstrz( s, c->raw + ( cx * TOKLEN ), TOKLEN );
+    }
+    sink += s->l;
+    free_bstr( s );
+}
+
+void
+op_tok_new_bstr( struct bcase *c )
+{
+    /* One small bstr per token, then all of them at once */
+    size_t cx;
+    for ( cx = 0; cx < c->n; cx++ ) {
+        bstr *s = new_bstr( TOKLEN );
+        if ( !s ) { _fatal( "new_bstr" ); }
+        sink += s->a;
+    }
+    free_ALL_bstr();
+}
+
+void
+op_tok_splice( struct bcase *c )
+{
+    /* Drop every tenth token, from the back, on a fresh copy */
+    int cx;
+    bstr_copy( c->b, c->a );
+    for ( cx = (int)c->n - 1; cx >= 0; cx -= 10 ) {
+        bstr_splice( c->b, cx * TOKLEN, ( cx + 1 ) * TOKLEN, NULL );
+    }
+    sink += c->b->l;
+}
+
+/****************************************************************************
+ * Running and reporting
+ */
+void
+report( const char *op, const char *axis, struct bcase *c,
+        long iters, double ns, size_t allocs )
+{
+    double per = ns / iters;
+    double bps = ( per > 0 ) ? ( (double)c->bytes * 1e9 / per ) : 0;
+    double apo = (double)allocs / iters;
+
+    if ( bench.json ) {
+        printf( "%s\n    {\"op\":\"%s\",\"axis\":\"%s\",\"n\":%zu,"
+            "\"iters\":%ld,\"ns_per_op\":%.1f,\"bytes_per_sec\":%.0f,"
+            "\"allocs_per_op\":%.3f}",
+            bench.rows ? "," : "", op, axis, c->n, iters, per, bps, apo );
+    }
+    else {
+        printf( "%s,%s,%zu,%ld,%.1f,%.0f,%.3f,%s\n",
+            op, axis, c->n, iters, per, bps, apo, bscan_kernel() );
+    }
+    bench.rows++;
+    fflush( stdout );
+    return;
+}
+
+/* Run fn until target_ns is used up (at least once), report the mean */
+void
+run( const char *op, const char *axis, bench_fn fn, struct bcase *c )
+{
+    long iters = 1;
+    long done = 0;
+    double start, took;
+    size_t count0, count1;
+
+    /* One warm up, which also says how many will fit */
+    start = _now_ns();
+    fn( c );
+    took = _now_ns() - start;
+    if ( took < bench.target_ns ) {
+        iters = (long)( bench.target_ns / ( took > 1 ? took : 1 ) );
+        if ( iters > 50000000 ) {
+            iters = 50000000;
+        }
+    }
+    bstr_memstats( NULL, NULL, &count0 );
+    start = _now_ns();
+    for ( ; done < iters; done++ ) {
+        fn( c );
+    }
+    took = _now_ns() - start;
+    bstr_memstats( NULL, NULL, &count1 );
+    report( op, axis, c, iters, took, count1 - count0 );
+    return;
+}
+
+/* A string of n bytes, none of them NUL, ':' or 0x01 */
+char *
+make_raw( size_t n )
+{
+    size_t cx;
+    char *raw = malloc( n + 1 );
+    if ( !raw ) { _fatal( "make_raw" ); }
+    for ( cx = 0; cx < n; cx++ ) {
+        raw[cx] = 'a' + ( cx % 26 );
+    }
+    raw[n] = (char)0;
+    return raw;
+}
+
+/* n tokens of TOKLEN, each ending in ':' */
+char *
+make_tokens( size_t n )
+{
+    size_t cx;
+    char *raw = malloc( ( n * TOKLEN ) + 1 );
+    if ( !raw ) { _fatal( "make_tokens" ); }
+    for ( cx = 0; cx < n; cx++ ) {
+        char tok[TOKLEN + 1];
+        snprintf( tok, sizeof(tok), "/t/%04zu:", cx % 10000 );
+        memcpy( raw + ( cx * TOKLEN ), tok, TOKLEN );
+    }
+    raw[n * TOKLEN] = (char)0;
+    return raw;
+}
+
+bstr *
+make_bstr( const char *raw, size_t n )
+{
+    bstr *s = new_bstr( n );
+    if ( !s ) { _fatal( "new_bstr" ); }
+    bstr_catstrz( s, raw, n );
+    return s;
+}
+
+void
+size_axis()
+{
+    size_t n;
+    for ( n = 16; n <= bench.maxbytes; n *= 4 ) {
+        struct bcase c;
+        memset( &c, 0, sizeof(c) );
+        c.n     = n;
+        c.bytes = n;
+        c.raw   = make_raw( n );
+        c.a     = make_bstr( c.raw, n );
+        c.b     = make_bstr( c.raw, n );
+
+        run( "strz_len",    "bytes", op_strz_len,   &c );
+        run( "strz_len_n",  "bytes", op_strz_len_n, &c );
+        run( "strz_len_z",  "bytes", op_strz_len_z, &c );
+        run( "new_bstr",    "bytes", op_new_bstr,   &c );
+        run( "bstr_catstrz", "bytes", op_catstrz,   &c );
+        run( "bstr_index",  "bytes", op_index,      &c );
+        c.bytes = 2 * n;
+        run( "bstr_eq",     "bytes", op_eq,         &c );
+        c.bytes = n;
+        run( "bstr_splice", "bytes", op_splice,     &c );
+
+        free( c.raw );
+        free_ALL_bstr();
+        if ( n == bench.maxbytes ) {
+            break;
+        }
+        if ( ( n * 4 ) > bench.maxbytes ) {
+            /* Always finish on the largest size asked for */
+            n = bench.maxbytes / 4;
+        }
+    }
+    return;
+}
+
+void
+token_axis()
+{
+    size_t n;
+    for ( n = 10; n <= 1000000; n *= 10 ) {
+        struct bcase c;
+        memset( &c, 0, sizeof(c) );
+        c.n     = n;
+        c.bytes = n * TOKLEN;
+        c.raw   = make_tokens( n );
+        c.a     = make_bstr( c.raw, n * TOKLEN );
+        c.b     = make_bstr( c.raw, n * TOKLEN );
+
+        run( "bstr_index",   "tokens", op_tok_index,    &c );
+        run( "bstr_catstrz", "tokens", op_tok_catstrz,  &c );
+        /* Each splice moves the tail, this is quadratic, so it stops
+         * at 100K tokens rather than take minutes. */
+        if ( n <= 100000 ) {
+            run( "bstr_splice", "tokens", op_tok_splice, &c );
+        }
+        free( c.raw );
+        free_ALL_bstr();
+
+        /* Last, it resets the arena itself */
+        c.raw = NULL;
+        run( "new_bstr",     "tokens", op_tok_new_bstr, &c );
+    }
+    return;
+}
+
+size_t
+_parse_size( const char *arg )
+{
+    char *end = NULL;
+    size_t n = strtoul( arg, &end, 10 );
+    if ( ( 'k' == *end ) || ( 'K' == *end ) ) {
+        n <<= 10;
+    }
+    else if ( ( 'm' == *end ) || ( 'M' == *end ) ) {
+        n <<= 20;
+    }
+    return n;
+}
+
+int
+main( int argc, char *argv[] )
+{
+    int argcx;
+
+    bench.json      = 0;
+    bench.target_ns = 100 * 1000000L;
+    bench.maxbytes  = (size_t)64 << 20;
+    for ( argcx = 1; argcx < argc; argcx++ ) {
+        if ( 0 == strcmp( "-j", argv[argcx] ) ) {
+            bench.json = 1;
+        }
+        else if ( ( 0 == strcmp( "-t", argv[argcx] ) ) && ( argcx + 1 < argc ) ) {
+            bench.target_ns = atol( argv[++argcx] ) * 1000000L;
+        }
+        else if ( ( 0 == strcmp( "-m", argv[argcx] ) ) && ( argcx + 1 < argc ) ) {
+            bench.maxbytes = _parse_size( argv[++argcx] );
+        }
+        else {
+            fprintf( stderr, "Usage: %s [-j] [-t MS] [-m MAXBYTES]\n", argv[0] );
+            exit(2);
+        }
+    }
+    if ( bench.maxbytes < 16 ) {
+        bench.maxbytes = 16;
+    }
+
+    if ( bench.json ) {
+        printf( "{\"bench\":\"bstr\",\"kernel\":\"%s\",\"results\":[",
+            bscan_kernel() );
+    }
+    else {
+        printf( "op,axis,n,iters,ns_per_op,bytes_per_sec,allocs_per_op,kernel\n" );
+    }
+    size_axis();
+    token_axis();
+    if ( bench.json ) {
+        printf( "\n]}\n" );
+    }
+    free_ALL_bstr();
+    return 0;
+}
@@ -0,0 +1,241 @@
+/****************************************************************************
+ * bench/dedupe_bench.c
+ *
+ * Dedupe of very long lists through the library, serial and sharded
+ * over threads (cleanpath_queue() with jobs, see shard.h), to see it
+ * scale with cores.  Each list is made of "/dir/NNNNNNN" tokens, 40%
+ * of them copies of one before, in a random order.  Built and run by
+ * `make bench`.
+ *
+ *     dedupe_bench [-j] [-r RUNS] [-n MAXTOKENS] [-J MAXJOBS]
+ *         -j  JSON instead of CSV
+ *         -r  Runs per case, the median is reported (default 9)
+ *         -n  Longest list (default 4M), from 100k up by 4x
+ *         -J  Most threads (default the online CPUs), from 1 up by 2x
+ *
+ * One row per list length and jobs: median ns of the dedupe stage and
+ * of the whole cleanpath_run(), tokens per second through dedupe, and
+ * its speedup over jobs 1.  Every output is compared with jobs 1's, a
+ * difference is fatal.
+ *
+ * LICENSE: Same as cleanpath.c
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cleanpath.h"
+
+#define MIN_TOKENS  100000
+#define DUPES       40      // Percent of the tokens that are copies
+
+struct {
+    int     json;
+    int     runs;
+    long    maxtokens;
+    int     maxjobs;
+    int     rows;
+    unsigned long seed;
+} bench;
+
+void
+_fatal( const char *where )
+{
+    fprintf( stderr, "Fatal: %s(): %s\n", where, strerror(errno) );
+    exit(5);
+}
+
+double
+_now_ns()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ( (double)ts.tv_sec * 1e9 ) + (double)ts.tv_nsec;
+}
+
+/* Small LCG, so every run of the bench makes the same lists */
+unsigned long
+_rand()
+{
+    bench.seed = ( bench.seed * 6364136223846793005UL ) + 1442695040888963407UL;
+    return bench.seed >> 33;
+}
+
+int
+_cmp_double( const void *a, const void *b )
+{
+    double da = *(const double *)a;
+    double db = *(const double *)b;
+    return ( da > db ) - ( da < db );
+}
+
+/* n tokens, each new one or (DUPES percent of the time) one already made */
+char *
+list_make( long n )
+{
+    char   *list = malloc( n * 16 + 1 );
+    long   *ids = malloc( n * sizeof(long) );
+    size_t  l = 0;
+    long    made = 0;
+    long    cx;
+
+    if ( ( !list ) || ( !ids ) ) { _fatal( "malloc" ); }
+    for ( cx = 0; cx < n; cx++ ) {
+        if ( ( made ) && ( DUPES > (long)( _rand() % 100 ) ) ) {
+            ids[cx] = ids[_rand() % cx];
+        }
+        else {
+            /* Spread out, so neighbours do not share a prefix */
+            ids[cx] = ( made++ * 7919 ) % 10000000;
+        }
+        l += sprintf( list + l, "%s/dir/%07ld", cx ? ":" : "", ids[cx] );
+    }
+    free( ids );
+    return list;
+}
+
+/* One cleanpath_run() of list, its output (the caller frees it) */
+char *
+run_one( const char *list, int jobs, double *dedupe_ns, double *run_ns )
+{
+    struct cleanpath cp;
+    double  t0;
+    char   *out;
+
+    cleanpath_init( &cp );
+    cp.input = list;
+    cp.jobs  = jobs;
+    t0 = _now_ns();
+    if ( cleanpath_run( &cp ) ) { _fatal( "cleanpath_run" ); }
+    *run_ns    = _now_ns() - t0;
+    *dedupe_ns = (double)cp.count.dedupe_ns;
+    out = cp.out;
+    cp.out = NULL;
+    cleanpath_free( &cp );
+    return out;
+}
+
+void
+report( long n, int jobs, double dedupe_ns, double run_ns, double base_ns )
+{
+    double tps = ( dedupe_ns > 0 ) ? ( (double)n * 1e9 / dedupe_ns ) : 0;
+    double speedup = ( dedupe_ns > 0 ) ? ( base_ns / dedupe_ns ) : 0;
+
+    if ( bench.json ) {
+        printf( "%s\n    {\"tokens\":%ld,\"jobs\":%d,\"dedupe_ns\":%.0f,"
+            "\"run_ns\":%.0f,\"tokens_per_sec\":%.0f,\"speedup\":%.2f}",
+            bench.rows ? "," : "", n, jobs, dedupe_ns, run_ns, tps,
+            speedup );
+    }
+    else {
+        printf( "%ld,%d,%.0f,%.0f,%.0f,%.2f\n",
+            n, jobs, dedupe_ns, run_ns, tps, speedup );
+    }
+    bench.rows++;
+    fflush( stdout );
+    return;
+}
+
+/* Every jobs for one list length */
+void
+bench_list( long n )
+{
+    char   *list = list_make( n );
+    char   *want = NULL;
+    double *dd = malloc( bench.runs * sizeof(double) );
+    double *rr = malloc( bench.runs * sizeof(double) );
+    double  base_ns = 0;
+    int     jobs;
+    int     rx;
+
+    if ( ( !dd ) || ( !rr ) ) { _fatal( "malloc" ); }
+    for ( jobs = 1; ; jobs = ( 2 * jobs < bench.maxjobs ) ? 2 * jobs
+                                                      : bench.maxjobs )
+    {
+        for ( rx = 0; rx < bench.runs; rx++ ) {
+            char *out = run_one( list, jobs, &dd[rx], &rr[rx] );
+            if ( !want ) {
+                want = out;
+                continue;
+            }
+            if ( strcmp( want, out ) ) {
+                fprintf( stderr, "Fatal: %ld tokens, %d jobs: the output"
+                    " is not the same as with 1\n", n, jobs );
+                exit(5);
+            }
+            free( out );
+        }
+        qsort( dd, bench.runs, sizeof(double), _cmp_double );
+        qsort( rr, bench.runs, sizeof(double), _cmp_double );
+        if ( 1 == jobs ) {
+            base_ns = dd[bench.runs / 2];
+        }
+        report( n, jobs, dd[bench.runs / 2], rr[bench.runs / 2], base_ns );
+        if ( jobs == bench.maxjobs ) {
+            break;
+        }
+    }
+    free( want );
+    free( list );
+    free( dd );
+    free( rr );
+    return;
+}
+
+int
+main( int argc, char *argv[] )
+{
+    int argcx;
+    long n;
+
+    bench.json      = 0;
+    bench.runs      = 9;
+    bench.maxtokens = 4L << 20;
+    bench.maxjobs   = (int)sysconf( _SC_NPROCESSORS_ONLN );
+    bench.seed      = 42;
+    for ( argcx = 1; argcx < argc; argcx++ ) {
+        if ( 0 == strcmp( "-j", argv[argcx] ) ) {
+            bench.json = 1;
+        }
+        else if ( ( 0 == strcmp( "-r", argv[argcx] ) ) && ( argcx + 1 < argc ) ) {
+            bench.runs = atoi( argv[++argcx] );
+        }
+        else if ( ( 0 == strcmp( "-n", argv[argcx] ) ) && ( argcx + 1 < argc ) ) {
+            bench.maxtokens = atol( argv[++argcx] );
+        }
+        else if ( ( 0 == strcmp( "-J", argv[argcx] ) ) && ( argcx + 1 < argc ) ) {
+            bench.maxjobs = atoi( argv[++argcx] );
+        }
+        else {
+            fprintf( stderr, "Usage: %s [-j] [-r RUNS] [-n MAXTOKENS]"
+                " [-J MAXJOBS]\n", argv[0] );
+            exit(2);
+        }
+    }
+    if ( bench.runs < 1 ) {
+        bench.runs = 1;
+    }
+    if ( bench.maxjobs < 1 ) {
+        bench.maxjobs = 1;
+    }
+    if ( bench.maxtokens < MIN_TOKENS ) {
+        bench.maxtokens = MIN_TOKENS;
+    }
+
+    if ( bench.json ) {
+        printf( "{\"bench\":\"dedupe\",\"results\":[" );
+    }
+    else {
+        printf( "tokens,jobs,dedupe_ns,run_ns,tokens_per_sec,speedup\n" );
+    }
+    for ( n = MIN_TOKENS; n <= bench.maxtokens; n *= 4 ) {
+        bench_list( n );
+    }
+    if ( bench.json ) {
+        printf( "\n]}\n" );
+    }
+    return 0;
+}
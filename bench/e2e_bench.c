@@ -0,0 +1,394 @@
+/****************************************************************************
+ * bench/e2e_bench.c
+ *
+ * End to end timing of the real cleanpath binary on PATH-like lists,
+ * built in a temp tree with real directories, symlinks to them, plain
+ * files and names that do not exist.  Each list has 30-60% duplicates
+ * and some redundant delimiters.  Built and run by `make bench`.
+ *
+ *     e2e_bench [-j] [-r RUNS] [-n MAXTOKENS] [BINARY]
+ *         -j  JSON instead of CSV
+ *         -r  Runs per case (default 50, fewer for the huge ones)
+ *         -n  Largest list for the --stdin scaling cases (default 1M)
+ *         BINARY defaults to ./cleanpath
+ *
+ * Each case is run RUNS times, each a fork and exec with stdout to
+ * /dev/null.  Reported: p50/p99 wall time, mean user and sys time and
+ * the largest max RSS, all from wait4().  The token counts of each
+ * flag combination make the scaling curve: time per token should stay
+ * flat, growing means something went quadratic.
+ *
+ * LICENSE: Same as cleanpath.c
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define TREE_DIRS   2000    // Real directories made, the rest are missing
+#define ENV_MAX     4000    // A bigger list is past one env string's limit
+
+struct {
+    int     json;
+    int     runs;
+    long    maxtokens;
+    const char *binary;
+    char    tree[256];
+    int     rows;
+    unsigned long seed;
+} bench;
+
+/* How a case runs the binary */
+struct ecase {
+    const char *name;   // Flag combination, as reported
+    const char *var;    // Put the list in this env var, or NULL
+    char    delim;
+    int     onstdin;    // List on stdin instead
+    const char *argv[8];
+};
+
+void
+_fatal( const char *where )
+{
+    fprintf( stderr, "Fatal: %s(): %s\n", where, strerror(errno) );
+    exit(5);
+}
+
+double
+_now_us()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ( (double)ts.tv_sec * 1e6 ) + ( (double)ts.tv_nsec / 1e3 );
+}
+
+/* Small LCG, so every run of the bench makes the same lists */
+unsigned long
+_rand()
+{
+    bench.seed = ( bench.seed * 6364136223846793005UL ) + 1442695040888963407UL;
+    return bench.seed >> 33;
+}
+
+/****************************************************************************
+ * The temp tree: dNNNN directories, lNNNN symlinks to them, fNNNN files
+ */
+void
+tree_make()
+{
+    const char *tmp = getenv("TMPDIR");
+    char path[512];
+    int cx;
+
+    snprintf( bench.tree, sizeof(bench.tree), "%s/cpbench.XXXXXX",
+        ( tmp && *tmp ) ? tmp : "/tmp" );
+    if ( !mkdtemp( bench.tree ) ) { _fatal( "mkdtemp" ); }
+    for ( cx = 0; cx < TREE_DIRS; cx++ ) {
+        snprintf( path, sizeof(path), "%s/d%04d", bench.tree, cx );
+        if ( mkdir( path, 0700 ) ) { _fatal( "mkdir" ); }
+        if ( 0 == ( cx % 4 ) ) {
+            char link[512];
+            snprintf( link, sizeof(link), "%s/l%04d", bench.tree, cx );
+            if ( symlink( path, link ) ) { _fatal( "symlink" ); }
+        }
+        if ( 0 == ( cx % 8 ) ) {
+            int fd;
+            snprintf( path, sizeof(path), "%s/f%04d", bench.tree, cx );
+            fd = open( path, O_WRONLY | O_CREAT, 0600 );
+            if ( 0 > fd ) { _fatal( "open" ); }
+            close( fd );
+        }
+    }
+    return;
+}
+
+void
+tree_remove()
+{
+    char path[512];
+    int cx;
+    for ( cx = 0; cx < TREE_DIRS; cx++ ) {
+        snprintf( path, sizeof(path), "%s/l%04d", bench.tree, cx );
+        unlink( path );
+        snprintf( path, sizeof(path), "%s/f%04d", bench.tree, cx );
+        unlink( path );
+        snprintf( path, sizeof(path), "%s/d%04d", bench.tree, cx );
+        rmdir( path );
+    }
+    rmdir( bench.tree );
+    return;
+}
+
+/*
+ * A list of n tokens.  A pool of distinct entries (mostly directories,
+ * then symlinks, missing names and files) is drawn from with 30-60%
+ * repeats, and about one delimiter in twenty is doubled.
+ */
+char *
+make_list( long n, char delim )
+{
+    double dupfrac = 0.30 + ( ( _rand() % 31 ) / 100.0 );
+    long pool = (long)( n * ( 1.0 - dupfrac ) );
+    size_t a = ( n * ( strlen(bench.tree) + 16 ) ) + 1;
+    char *list = malloc( a );
+    size_t l = 0;
+    long cx;
+
+    if ( !list ) { _fatal( "make_list" ); }
+    if ( pool < 1 ) {
+        pool = 1;
+    }
+    for ( cx = 0; cx < n; cx++ ) {
+        /* The first pool entries go in order, then repeats at random */
+        long px = ( cx < pool ) ? cx : (long)( _rand() % pool );
+        long dx = px % TREE_DIRS;
+        int kind = px % 20;
+        if ( l ) {
+            list[l++] = delim;
+            if ( 0 == ( _rand() % 20 ) ) {
+                list[l++] = delim;
+            }
+        }
+        if ( px >= TREE_DIRS ) {
+            /* More entries than directories, the rest are missing */
+            l += sprintf( list + l, "%s/x%07ld", bench.tree, px );
+        }
+        else if ( kind < 12 ) {
+            l += sprintf( list + l, "%s/d%04ld", bench.tree, dx );
+        }
+        else if ( kind < 15 ) {
+            l += sprintf( list + l, "%s/l%04ld", bench.tree, dx & ~3L );
+        }
+        else if ( kind < 18 ) {
+            l += sprintf( list + l, "%s/m%04ld", bench.tree, dx );
+        }
+        else {
+            l += sprintf( list + l, "%s/f%04ld", bench.tree, dx & ~7L );
+        }
+    }
+    list[l] = (char)0;
+    return list;
+}
+
+/****************************************************************************
+ * Running and reporting
+ */
+int
+_cmp_double( const void *a, const void *b )
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return ( x < y ) ? -1 : ( x > y );
+}
+
+void
+report( const struct ecase *ec, long n, size_t bytes, int runs,
+        double *wall, double user, double sys, long maxrss )
+{
+    double p50, p99;
+    int p99x = (int)( runs * 0.99 );
+
+    qsort( wall, runs, sizeof(double), _cmp_double );
+    if ( p99x >= runs ) {
+        p99x = runs - 1;
+    }
+    p50 = wall[runs / 2];
+    p99 = wall[p99x];
+    if ( bench.json ) {
+        printf( "%s\n    {\"case\":\"%s\",\"tokens\":%ld,\"bytes\":%zu,"
+            "\"runs\":%d,\"p50_us\":%.1f,\"p99_us\":%.1f,\"user_us\":%.1f,"
+            "\"sys_us\":%.1f,\"maxrss_kb\":%ld,\"p50_ns_per_token\":%.1f}",
+            bench.rows ? "," : "", ec->name, n, bytes, runs, p50, p99,
+            user / runs, sys / runs, maxrss, ( p50 * 1000.0 ) / n );
+    }
+    else {
+        /* Quoted, "-XF," has a comma in it */
+        printf( "\"%s\",%ld,%zu,%d,%.1f,%.1f,%.1f,%.1f,%ld,%.1f\n",
+            ec->name, n, bytes, runs, p50, p99, user / runs, sys / runs,
+            maxrss, ( p50 * 1000.0 ) / n );
+    }
+    bench.rows++;
+    fflush( stdout );
+    return;
+}
+
+void
+run_case( const struct ecase *ec, long n )
+{
+    char *list = make_list( n, ec->delim );
+    size_t bytes = strlen( list );
+    char *envp[3] = { NULL, NULL, NULL };
+    char *envstr = NULL;
+    char infile[300];
+    int runs = bench.runs;
+    double *wall;
+    double user = 0;
+    double sys = 0;
+    long maxrss = 0;
+    int rx;
+
+    /* Keep the huge ones to a sane total */
+    if ( ( n >= 100000 ) && ( runs > ( 2000000 / n ) ) ) {
+        runs = 2000000 / n;
+        if ( runs < 3 ) {
+            runs = 3;
+        }
+    }
+    wall = malloc( runs * sizeof(double) );
+    if ( !wall ) { _fatal( "run_case" ); }
+
+    infile[0] = (char)0;
+    if ( ec->onstdin ) {
+        int fd;
+        snprintf( infile, sizeof(infile), "%s/input", bench.tree );
+        fd = open( infile, O_WRONLY | O_CREAT | O_TRUNC, 0600 );
+        if ( ( 0 > fd ) || ( (ssize_t)bytes != write( fd, list, bytes ) ) ) {
+            _fatal( "write" );
+        }
+        close( fd );
+    }
+    if ( ec->var ) {
+        envstr = malloc( strlen( ec->var ) + 1 + bytes + 1 );
+        if ( !envstr ) { _fatal( "run_case" ); }
+        sprintf( envstr, "%s=%s", ec->var, list );
+        envp[0] = envstr;
+    }
+    envp[envp[0] ? 1 : 0] = "LC_ALL=C";
+
+    for ( rx = 0; rx < runs; rx++ ) {
+        struct rusage ru;
+        int status;
+        double start = _now_us();
+        pid_t pid = fork();
+        if ( 0 > pid ) { _fatal( "fork" ); }
+        if ( 0 == pid ) {
+            const char *argv[12];
+            int ax = 0;
+            int nul = open( "/dev/null", O_WRONLY );
+            dup2( nul, 1 );
+            if ( infile[0] ) {
+                int in = open( infile, O_RDONLY );
+                dup2( in, 0 );
+            }
+            argv[ax++] = bench.binary;
+            while ( ec->argv[ax - 1] ) {
+                argv[ax] = ec->argv[ax - 1];
+                ax++;
+            }
+            if ( ( !ec->var ) && ( !ec->onstdin ) ) {
+                /* The list itself is ENVADD */
+                argv[ax++] = list;
+            }
+            argv[ax] = NULL;
+            execve( bench.binary, (char **)argv, envp );
+            _exit(127);
+        }
+        if ( 0 > wait4( pid, &status, 0, &ru ) ) { _fatal( "wait4" ); }
+        wall[rx] = _now_us() - start;
+        if ( ( !WIFEXITED(status) ) || ( WEXITSTATUS(status) ) ) {
+            fprintf( stderr, "%s, %ld tokens: exit status %d\n",
+                ec->name, n, WEXITSTATUS(status) );
+            break;
+        }
+        user += ( ru.ru_utime.tv_sec * 1e6 ) + ru.ru_utime.tv_usec;
+        sys  += ( ru.ru_stime.tv_sec * 1e6 ) + ru.ru_stime.tv_usec;
+        if ( ru.ru_maxrss > maxrss ) {
+            maxrss = ru.ru_maxrss;
+        }
+    }
+    if ( rx == runs ) {
+        report( ec, n, bytes, runs, wall, user, sys, maxrss );
+    }
+    if ( infile[0] ) {
+        unlink( infile );
+    }
+    free( envstr );
+    free( wall );
+    free( list );
+    return;
+}
+
+int
+main( int argc, char *argv[] )
+{
+    /* The common combinations, the list in PATH (or an arg) */
+    struct ecase cases[] = {
+        { "-P",   "PATH", ':', 0, { "-P", NULL } },
+        { "-Pb",  "PATH", ':', 0, { "-Pb", "--", "/usr/local/bin", "/opt/bin", NULL } },
+        { "-e",   "PATH", ':', 0, { "-e", NULL } },
+        /* A library path list, not in LD_LIBRARY_PATH itself, or the
+         * loader would search all of it before cleanpath even ran */
+        { "-P LIBPATH", "LIBPATH", ':', 0, { "-P", "LIBPATH", NULL } },
+        { "-XF,", NULL,   ',', 0, { "-XF,", "--", NULL } },
+    };
+    /* Past what an environment variable can hold */
+    struct ecase big = { "-P --stdin", NULL, ':', 1, { "-P", "--stdin", NULL } };
+    long sizes[] = { 10, 100, 1000, ENV_MAX };
+    int argcx;
+    int cx;
+    int sx;
+    long n;
+
+    bench.json      = 0;
+    bench.runs      = 50;
+    bench.maxtokens = 1000000;
+    bench.binary    = "./cleanpath";
+    bench.seed      = 1;
+    for ( argcx = 1; argcx < argc; argcx++ ) {
+        if ( 0 == strcmp( "-j", argv[argcx] ) ) {
+            bench.json = 1;
+        }
+        else if ( ( 0 == strcmp( "-r", argv[argcx] ) ) && ( argcx + 1 < argc ) ) {
+            bench.runs = atoi( argv[++argcx] );
+        }
+        else if ( ( 0 == strcmp( "-n", argv[argcx] ) ) && ( argcx + 1 < argc ) ) {
+            bench.maxtokens = atol( argv[++argcx] );
+        }
+        else if ( '-' != argv[argcx][0] ) {
+            bench.binary = argv[argcx];
+        }
+        else {
+            fprintf( stderr, "Usage: %s [-j] [-r RUNS] [-n MAXTOKENS] [BINARY]\n",
+                argv[0] );
+            exit(2);
+        }
+    }
+    if ( bench.runs < 1 ) {
+        bench.runs = 1;
+    }
+    if ( access( bench.binary, X_OK ) ) {
+        fprintf( stderr, "Can not run '%s': %s\n", bench.binary, strerror(errno) );
+        exit(2);
+    }
+
+    tree_make();
+    if ( bench.json ) {
+        printf( "{\"bench\":\"e2e\",\"binary\":\"%s\",\"results\":[",
+            bench.binary );
+    }
+    else {
+        printf( "case,tokens,bytes,runs,p50_us,p99_us,user_us,sys_us,"
+            "maxrss_kb,p50_ns_per_token\n" );
+    }
+    for ( cx = 0; cx < (int)( sizeof(cases) / sizeof(cases[0]) ); cx++ ) {
+        for ( sx = 0; sx < (int)( sizeof(sizes) / sizeof(sizes[0]) ); sx++ ) {
+            run_case( &cases[cx], sizes[sx] );
+        }
+    }
+    for ( n = 1000; n <= bench.maxtokens; n *= 10 ) {
+        run_case( &big, n );
+    }
+    if ( bench.json ) {
+        printf( "\n]}\n" );
+    }
+    tree_remove();
+    return 0;
+}
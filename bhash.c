@@ -0,0 +1,130 @@
+#define BHASH_VERSION "0.01"
+#include <stdlib.h>
+/* errno */
+#include <errno.h>
+/* memcmp */
+#include <string.h>
+
+#include "bhash.h"
+
+int     _bhash_grow(bhash *set);
+
+/* FNV-1a, 32 bit.  Tokens are short, this is plenty. */
+uint32_t
+bhash_sum(const char *key, size_t len)
+{
+    register uint32_t h = 2166136261u;
+    register const unsigned char *cx = (const unsigned char *)key;
+    register const unsigned char *end = cx + len;
+    for ( ; cx < end; cx++ ) {
+        h ^= *cx;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+int
+bhash_init(bhash *set, size_t expect)
+{
+    size_t slots = 16;
+    /* Keep the load under one half */
+    while ( slots < ( expect * 2 ) ) {
+        slots <<= 1;
+    }
+    set->n = 0;
+    set->m = slots - 1;
+    set->e = calloc( slots, sizeof(bhent) );
+    if ( !set->e ) {
+        errno = ENOMEM;
+        return -1;
+    }
+    return 0;
+}
+
+void
+bhash_free(bhash *set)
+{
+    if ( set->e ) {
+        free( set->e );
+    }
+    set->e = NULL;
+    set->n = 0;
+    set->m = 0;
+    return;
+}
+
+bhent *
+bhash_find(const bhash *set, const char *key, size_t len, uint32_t h)
+{
+    register size_t cx = h & set->m;
+    while ( set->e[cx].s ) {
+        bhent *ent = &set->e[cx];
+        if ( ( ent->h == h ) && ( ent->l == len )
+            && ( 0 == memcmp( ent->s, key, len ) ) )
+        {
+            return ent;
+        }
+        cx = ( cx + 1 ) & set->m;
+    }
+    return NULL;
+}
+
+int
+_bhash_grow(bhash *set)
+{
+    size_t  oldslots = set->m + 1;
+    bhent * old = set->e;
+    size_t  cx;
+
+    set->e = calloc( oldslots * 2, sizeof(bhent) );
+    if ( !set->e ) {
+        set->e = old;
+        errno = ENOMEM;
+        return -1;
+    }
+    set->m = ( oldslots * 2 ) - 1;
+    for ( cx = 0; cx < oldslots; cx++ ) {
+        if ( old[cx].s ) {
+            size_t nx = old[cx].h & set->m;
+            while ( set->e[nx].s ) {
+                nx = ( nx + 1 ) & set->m;
+            }
+            set->e[nx] = old[cx];
+        }
+    }
+    free(old);
+    return 0;
+}
+
+int
+bhash_add(bhash *set, const char *key, size_t len, int val, bhent **found)
+{
+    return bhash_put(set, key, len, bhash_sum(key, len), val, found);
+}
+
+int
+bhash_put(bhash *set, const char *key, size_t len, uint32_t h, int val,
+          bhent **found)
+{
+    bhent *ent = bhash_find(set, key, len, h);
+    if ( ent ) {
+        if ( found ) { *found = ent; }
+        return 0;
+    }
+    if ( ( ( set->n + 1 ) * 2 ) > ( set->m + 1 ) ) {
+        if ( _bhash_grow(set) ) {
+            return -1;
+        }
+    }
+    register size_t cx = h & set->m;
+    while ( set->e[cx].s ) {
+        cx = ( cx + 1 ) & set->m;
+    }
+    set->e[cx].s = key;
+    set->e[cx].l = len;
+    set->e[cx].h = h;
+    set->e[cx].v = val;
+    set->n++;
+    if ( found ) { *found = &set->e[cx]; }
+    return 1;
+}
@@ -0,0 +1,35 @@
+#ifndef VOLLINK_BHASH_H
+#define VOLLINK_BHASH_H
+
+#include <stdint.h>
+
+/* One slot of the set, the key bytes are NOT copied, so they must
+ * live at least as long as the set does. */
+typedef struct {
+    const char *    s;
+    size_t          l;
+    uint32_t        h;
+    int             v;
+} bhent;
+
+typedef struct {
+    bhent * e;      // Slots
+    size_t  n;      // Used slots
+    size_t  m;      // Slot mask (slot count - 1)
+} bhash;
+
+uint32_t bhash_sum(const char *key, size_t len);
+        // expect is a hint, the set grows as needed, -1 (ENOMEM)
+int     bhash_init(bhash *set, size_t expect);
+void    bhash_free(bhash *set);
+        // NULL if not found
+bhent * bhash_find(const bhash *set, const char *key, size_t len, uint32_t h);
+        // 1 if added, 0 if already there, -1 on allocation failure
+        // On 0, *found (if given) points at the existing entry
+int     bhash_add(bhash *set, const char *key, size_t len, int val,
+                  bhent **found);
+        // bhash_add() when h, bhash_sum() of key, is already known
+int     bhash_put(bhash *set, const char *key, size_t len, uint32_t h,
+                  int val, bhent **found);
+
+#endif
@@ -0,0 +1,437 @@
+#define BSCAN_VERSION "0.01"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "configure.h"
+
+#include "bscan.h"
+
+/*
+ * Every kernel answers the same question as the scalar loop, they just
+ * look at 16, 32 or 64 bytes per step.  Bounded scans (bscan_chr) only
+ * ever load inside src[0..len).  The unbounded scan (bscan_len) uses
+ * aligned loads, which may read before src or past the NUL, but never
+ * across a page boundary, so they cannot fault.  bscan_path() only has
+ * its search vectorized: the first / followed by / or . (so the first
+ * byte that normalizing might change), which most paths never have.
+ */
+#if defined(__x86_64__) || defined(__i386__)
+#if defined(__SSE2__)
+#define BSCAN_SSE2 1
+#include <immintrin.h>
+#endif
+#if defined(BSCAN_SSE2) && defined(HAVE_CPU_DISPATCH)
+#define BSCAN_AVX2 1
+#define BSCAN_AVX512 1
+#endif
+#endif
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define BSCAN_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define BSCAN_NOASAN __attribute__((no_sanitize_address))
+#else
+#define BSCAN_NOASAN
+#endif
+
+typedef size_t (*chr_fn)(const char *, size_t, char);
+typedef size_t (*len_fn)(const char *);
+typedef size_t (*dirty_fn)(const char *, size_t);
+
+size_t  _chr_resolve(const char *src, size_t len, char c);
+size_t  _len_resolve(const char *src);
+size_t  _dirty_resolve(const char *src, size_t len);
+
+chr_fn  _bscan_chr    = _chr_resolve;
+len_fn  _bscan_len    = _len_resolve;
+dirty_fn _bscan_dirty = _dirty_resolve;
+const char * _bscan_kernel = NULL;
+
+/****************************************************************************
+ * Scalar, always available
+ */
+size_t
+_chr_scalar(const char *src, size_t len, char c)
+{
+    register const char *cx = src;
+    register const char *end = src + len;
+    for ( ; cx < end; cx++ ) {
+        if ( c == *cx ) { return ( cx - src ); }
+    }
+    return len;
+}
+
+size_t
+_len_scalar(const char *src)
+{
+    register const char *cx = src;
+    for( ; ; cx++ ) {
+        if ( (char)0 == *cx ) { return ( cx - src ); }
+    }
+    return 0;
+}
+
+/* Offset of the first / followed by / or ., len if none */
+size_t
+_dirty_scalar(const char *src, size_t len)
+{
+    register size_t cx;
+    for ( cx = 0; ( cx + 1 ) < len; cx++ ) {
+        if ( ( '/' == src[cx] )
+            && ( ( '/' == src[cx + 1] ) || ( '.' == src[cx + 1] ) ) )
+        {
+            return cx;
+        }
+    }
+    return len;
+}
+
+/****************************************************************************
+ * x86 SSE2 (always there on x86_64), AVX2 and AVX-512BW
+ */
+#ifdef BSCAN_SSE2
+size_t
+_chr_sse2(const char *src, size_t len, char c)
+{
+    const __m128i needle = _mm_set1_epi8(c);
+    size_t cx = 0;
+    for ( ; ( cx + 16 ) <= len; cx += 16 ) {
+        __m128i blk = _mm_loadu_si128( (const __m128i *)(src + cx) );
+        unsigned mask = _mm_movemask_epi8( _mm_cmpeq_epi8(blk, needle) );
+        if ( mask ) {
+            return cx + __builtin_ctz(mask);
+        }
+    }
+    return cx + _chr_scalar( src + cx, len - cx, c );
+}
+
+size_t
+_dirty_sse2(const char *src, size_t len)
+{
+    const __m128i slash = _mm_set1_epi8('/');
+    const __m128i dot = _mm_set1_epi8('.');
+    size_t cx = 0;
+    /* Each byte against the one after it, both loads inside src */
+    for ( ; ( cx + 17 ) <= len; cx += 16 ) {
+        __m128i blk = _mm_loadu_si128( (const __m128i *)(src + cx) );
+        __m128i nxt = _mm_loadu_si128( (const __m128i *)(src + cx + 1) );
+        __m128i hit = _mm_and_si128( _mm_cmpeq_epi8(blk, slash),
+            _mm_or_si128( _mm_cmpeq_epi8(nxt, slash),
+                          _mm_cmpeq_epi8(nxt, dot) ) );
+        unsigned mask = _mm_movemask_epi8( hit );
+        if ( mask ) {
+            return cx + __builtin_ctz(mask);
+        }
+    }
+    return cx + _dirty_scalar( src + cx, len - cx );
+}
+
+BSCAN_NOASAN size_t
+_len_sse2(const char *src)
+{
+    const __m128i zero = _mm_setzero_si128();
+    uintptr_t off = (uintptr_t)src & 15;
+    const char *blk = src - off;
+    unsigned mask = _mm_movemask_epi8(
+        _mm_cmpeq_epi8( _mm_load_si128( (const __m128i *)blk ), zero ) );
+    mask >>= off;
+    if ( mask ) {
+        return __builtin_ctz(mask);
+    }
+    for ( blk += 16; ; blk += 16 ) {
+        mask = _mm_movemask_epi8(
+            _mm_cmpeq_epi8( _mm_load_si128( (const __m128i *)blk ), zero ) );
+        if ( mask ) {
+            return ( blk - src ) + __builtin_ctz(mask);
+        }
+    }
+}
+#endif
+
+#ifdef BSCAN_AVX2
+__attribute__((target("avx2"))) size_t
+_chr_avx2(const char *src, size_t len, char c)
+{
+    const __m256i needle = _mm256_set1_epi8(c);
+    size_t cx = 0;
+    for ( ; ( cx + 32 ) <= len; cx += 32 ) {
+        __m256i blk = _mm256_loadu_si256( (const __m256i *)(src + cx) );
+        unsigned mask = _mm256_movemask_epi8( _mm256_cmpeq_epi8(blk, needle) );
+        if ( mask ) {
+            return cx + __builtin_ctz(mask);
+        }
+    }
+    return cx + _chr_sse2( src + cx, len - cx, c );
+}
+
+__attribute__((target("avx2"))) size_t
+_dirty_avx2(const char *src, size_t len)
+{
+    const __m256i slash = _mm256_set1_epi8('/');
+    const __m256i dot = _mm256_set1_epi8('.');
+    size_t cx = 0;
+    for ( ; ( cx + 33 ) <= len; cx += 32 ) {
+        __m256i blk = _mm256_loadu_si256( (const __m256i *)(src + cx) );
+        __m256i nxt = _mm256_loadu_si256( (const __m256i *)(src + cx + 1) );
+        __m256i hit = _mm256_and_si256( _mm256_cmpeq_epi8(blk, slash),
+            _mm256_or_si256( _mm256_cmpeq_epi8(nxt, slash),
+                             _mm256_cmpeq_epi8(nxt, dot) ) );
+        unsigned mask = _mm256_movemask_epi8( hit );
+        if ( mask ) {
+            return cx + __builtin_ctz(mask);
+        }
+    }
+    return cx + _dirty_sse2( src + cx, len - cx );
+}
+
+__attribute__((target("avx2"))) BSCAN_NOASAN size_t
+_len_avx2(const char *src)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    uintptr_t off = (uintptr_t)src & 31;
+    const char *blk = src - off;
+    unsigned mask = _mm256_movemask_epi8(
+        _mm256_cmpeq_epi8( _mm256_load_si256( (const __m256i *)blk ), zero ) );
+    mask >>= off;
+    if ( mask ) {
+        return __builtin_ctz(mask);
+    }
+    for ( blk += 32; ; blk += 32 ) {
+        mask = _mm256_movemask_epi8(
+            _mm256_cmpeq_epi8( _mm256_load_si256( (const __m256i *)blk ), zero ) );
+        if ( mask ) {
+            return ( blk - src ) + __builtin_ctz(mask);
+        }
+    }
+}
+#endif
+
+#ifdef BSCAN_AVX512
+__attribute__((target("avx512f,avx512bw,avx2"))) size_t
+_chr_avx512(const char *src, size_t len, char c)
+{
+    const __m512i needle = _mm512_set1_epi8(c);
+    size_t cx = 0;
+    for ( ; ( cx + 64 ) <= len; cx += 64 ) {
+        __m512i blk = _mm512_loadu_si512( (const void *)(src + cx) );
+        uint64_t mask = _mm512_cmpeq_epi8_mask(blk, needle);
+        if ( mask ) {
+            return cx + __builtin_ctzll(mask);
+        }
+    }
+    return cx + _chr_avx2( src + cx, len - cx, c );
+}
+#endif
+
+/****************************************************************************
+ * arm64 NEON (always there on aarch64)
+ */
+#ifdef BSCAN_NEON
+/* Narrow a 16 byte compare result to a 64 bit mask, 4 bits per byte */
+#define NEON_MASK(eq) \
+    vget_lane_u64( vreinterpret_u64_u8( \
+        vshrn_n_u16( vreinterpretq_u16_u8(eq), 4 ) ), 0 )
+
+size_t
+_chr_neon(const char *src, size_t len, char c)
+{
+    const uint8x16_t needle = vdupq_n_u8( (uint8_t)c );
+    size_t cx = 0;
+    for ( ; ( cx + 16 ) <= len; cx += 16 ) {
+        uint8x16_t blk = vld1q_u8( (const uint8_t *)(src + cx) );
+        uint64_t mask = NEON_MASK( vceqq_u8(blk, needle) );
+        if ( mask ) {
+            return cx + ( __builtin_ctzll(mask) >> 2 );
+        }
+    }
+    return cx + _chr_scalar( src + cx, len - cx, c );
+}
+
+size_t
+_dirty_neon(const char *src, size_t len)
+{
+    const uint8x16_t slash = vdupq_n_u8('/');
+    const uint8x16_t dot = vdupq_n_u8('.');
+    size_t cx = 0;
+    for ( ; ( cx + 17 ) <= len; cx += 16 ) {
+        uint8x16_t blk = vld1q_u8( (const uint8_t *)(src + cx) );
+        uint8x16_t nxt = vld1q_u8( (const uint8_t *)(src + cx + 1) );
+        uint64_t mask = NEON_MASK( vandq_u8( vceqq_u8(blk, slash),
+            vorrq_u8( vceqq_u8(nxt, slash), vceqq_u8(nxt, dot) ) ) );
+        if ( mask ) {
+            return cx + ( __builtin_ctzll(mask) >> 2 );
+        }
+    }
+    return cx + _dirty_scalar( src + cx, len - cx );
+}
+
+BSCAN_NOASAN size_t
+_len_neon(const char *src)
+{
+    const uint8x16_t zero = vdupq_n_u8(0);
+    uintptr_t off = (uintptr_t)src & 15;
+    const char *blk = src - off;
+    uint64_t mask = NEON_MASK(
+        vceqq_u8( vld1q_u8( (const uint8_t *)blk ), zero ) );
+    mask >>= ( off << 2 );
+    if ( mask ) {
+        return ( __builtin_ctzll(mask) >> 2 );
+    }
+    for ( blk += 16; ; blk += 16 ) {
+        mask = NEON_MASK( vceqq_u8( vld1q_u8( (const uint8_t *)blk ), zero ) );
+        if ( mask ) {
+            return ( blk - src ) + ( __builtin_ctzll(mask) >> 2 );
+        }
+    }
+}
+#endif
+
+/****************************************************************************
+ * Dispatch, the first call through either pointer picks for both.
+ * Threads may race to resolve, they all store the same answer, and the
+ * relaxed atomics only keep that race well defined (they cost nothing).
+ */
+void
+_bscan_resolve()
+{
+    chr_fn  chr = _chr_scalar;
+    len_fn  len = _len_scalar;
+    dirty_fn dirty = _dirty_scalar;
+    const char *kernel = "scalar";
+#ifdef BSCAN_SSE2
+    chr = _chr_sse2;
+    len = _len_sse2;
+    dirty = _dirty_sse2;
+    kernel = "sse2";
+#endif
+#ifdef BSCAN_AVX2
+    __builtin_cpu_init();
+    if ( __builtin_cpu_supports("avx2") ) {
+        chr = _chr_avx2;
+        len = _len_avx2;
+        dirty = _dirty_avx2;
+        kernel = "avx2";
+    }
+#endif
+#ifdef BSCAN_AVX512
+    if ( __builtin_cpu_supports("avx512bw") ) {
+        chr = _chr_avx512;
+        kernel = "avx512bw";
+    }
+#endif
+#ifdef BSCAN_NEON
+    chr = _chr_neon;
+    len = _len_neon;
+    dirty = _dirty_neon;
+    kernel = "neon";
+#endif
+    __atomic_store_n( &_bscan_chr, chr, __ATOMIC_RELAXED );
+    __atomic_store_n( &_bscan_len, len, __ATOMIC_RELAXED );
+    __atomic_store_n( &_bscan_dirty, dirty, __ATOMIC_RELAXED );
+    __atomic_store_n( &_bscan_kernel, kernel, __ATOMIC_RELAXED );
+    return;
+}
+
+size_t
+_chr_resolve(const char *src, size_t len, char c)
+{
+    _bscan_resolve();
+    return _bscan_chr(src, len, c);
+}
+
+size_t
+_len_resolve(const char *src)
+{
+    _bscan_resolve();
+    return _bscan_len(src);
+}
+
+size_t
+_dirty_resolve(const char *src, size_t len)
+{
+    _bscan_resolve();
+    return _bscan_dirty(src, len);
+}
+
+size_t
+bscan_chr(const char *src, size_t len, char c)
+{
+    return __atomic_load_n( &_bscan_chr, __ATOMIC_RELAXED )(src, len, c);
+}
+
+size_t
+bscan_len(const char *src)
+{
+    return __atomic_load_n( &_bscan_len, __ATOMIC_RELAXED )(src);
+}
+
+/*
+ * One forward pass, writing behind where it reads, from the first
+ * byte that can change.  Whatever is before it is already clean.
+ */
+size_t
+bscan_path(char *src, size_t len)
+{
+    size_t rx = 0;
+    size_t wx;
+
+    /* A leading ./ (or several), "./" alone is "." */
+    while ( ( ( rx + 1 ) < len ) && ( '.' == src[rx] )
+        && ( '/' == src[rx + 1] ) )
+    {
+        for ( rx += 2; ( rx < len ) && ( '/' == src[rx] ); rx++ ) {
+        }
+    }
+    if ( rx ) {
+        if ( rx == len ) {
+            src[0] = '.';
+            return 1;
+        }
+        memmove( src, src + rx, len - rx );
+        len -= rx;
+    }
+
+    rx = __atomic_load_n( &_bscan_dirty, __ATOMIC_RELAXED )(src, len);
+    if ( rx == len ) {
+        /* Nothing to do, but maybe a trailing / */
+        return ( ( 1 < len ) && ( '/' == src[len - 1] ) ) ? len - 1 : len;
+    }
+    for ( wx = rx; rx < len; ) {
+        if ( '/' != src[rx] ) {
+            src[wx++] = src[rx++];
+            continue;
+        }
+        while ( ( ( rx + 1 ) < len ) && ( '/' == src[rx + 1] ) ) {
+            rx++;
+        }
+        if ( ( ( rx + 1 ) < len ) && ( '.' == src[rx + 1] )
+            && ( ( ( rx + 2 ) == len ) || ( '/' == src[rx + 2] ) ) )
+        {
+            /* "/." then / or the end: as if it were not there */
+            rx += 2;
+            continue;
+        }
+        src[wx++] = src[rx++];
+    }
+    if ( ( 1 < wx ) && ( '/' == src[wx - 1] ) ) {
+        wx--;
+    }
+    if ( 0 == wx ) {
+        /* "/." and the like, all of it went */
+        src[0] = '/';
+        wx = 1;
+    }
+    return wx;
+}
+
+const char *
+bscan_kernel()
+{
+    if ( !__atomic_load_n( &_bscan_kernel, __ATOMIC_RELAXED ) ) {
+        _bscan_resolve();
+    }
+    return _bscan_kernel;
+}
@@ -0,0 +1,21 @@
+#ifndef VOLLINK_BSCAN_H
+#define VOLLINK_BSCAN_H
+
+/*
+ * Byte scanning kernels for bstr.c and the tokenizer.
+ * The widest kernel the CPU supports is picked on first use.
+ */
+
+        // Offset of the first c in src[0..len), or len if there is none
+size_t  bscan_chr(const char *src, size_t len, char c);
+        // Offset of the first NUL, no limit (same as strlen)
+size_t  bscan_len(const char *src);
+        // Lexically normalize the path src[0..len) in place: each run of
+        // / becomes one, /. segments, a trailing / and a leading ./ go
+        // (.. stays, it is not lexical).  Returns the new length, src is
+        // not NUL terminated.  No syscalls, nothing is looked up.
+size_t  bscan_path(char *src, size_t len);
+        // Name of the kernel in use ("scalar", "sse2", "avx2", ...)
+const char * bscan_kernel();
+
+#endif
@@ -7,69 +7,107 @@
 #include <string.h>
 
 #include "bstr.h"
+#include "bscan.h"
 
-struct bary {
-    void ** s; // Pointer Set
-    size_t  l; // Used Length
-    size_t  a; // Allocated Bytes
-} alregistry;
+/* Every bstr (struct and string) is carved out of these pages, and all
+ * of them are handed back at once by free_ALL_bstr(). */
+struct bpage {
+    struct bpage *  next;
+    size_t          a;  // Allocated Bytes (after this header)
+    size_t          u;  // Used Bytes
+};
 
-int     _allocreg(void *reg);
-void    _allocfree(const size_t reg_t);
-void    _allocfreeall();
+struct {
+    struct bpage *  head;   // Current page, the only one bumped
+    size_t          held;   // Bytes currently held in pages
+    size_t          peak;   // Most bytes ever held in pages
+    size_t          total;  // Bytes handed out, all time
+    size_t          count;  // Allocations handed out, all time
+    size_t          moved;  // Bytes moved by bstr_splice(), all time
+} arena;
 
-int
-_allocreg(void *reg)
+#define BPAGE       ((size_t)65536)
+#define BPAGE_HDR   ( ( sizeof(struct bpage) + (MINCHUNK-1) ) & ~(MINCHUNK-1) )
+#define BPAGE_MEM(p) ( (char *)(p) + BPAGE_HDR )
+
+void *  _arena_alloc(size_t len);
+size_t  _arena_extend(void *mem, size_t oldlen, size_t newlen);
+void    _arena_release(void *mem, size_t len);
+int     _bstr_append(bstr *dest, const char *src, size_t ssz);
+#ifdef DEBUG
+int     bstr_check(const bstr *src, const char *caller);
+#define BSTR_CHECK(x)   bstr_check(x, __func__)
+#else
+#define BSTR_CHECK(x)
+#endif
+
+void *
+_arena_alloc(size_t len)
 {
-    if ( !alregistry.s ) {
-        size_t anew = ( sizeof(void *) * 256 );
-        memset(&alregistry, 0, sizeof(struct bary));
-        alregistry.s = malloc( anew );
-        if ( !alregistry.s ) { return -1; }
-        alregistry.a = anew;
-        memset(alregistry.s, 0, alregistry.a);
-        alregistry.s[alregistry.l++] = alregistry.s;
-    }
-    else if ( ( ( alregistry.l + 2 ) * sizeof(void *) ) <= alregistry.a ) {
-        size_t anew = alregistry.a + ( sizeof(void *) * 256 );
-        void *sold = alregistry.s;
-        void *snew = malloc(anew);
-        if ( !snew ) { return -1; }
-        if ( !memset( snew, 0, anew ) ) { return -1; }
-        if ( !memcpy( snew, alregistry.s, alregistry.a ) ) { return -1; }
-        alregistry.s = snew;
-        free(sold);
-        alregistry.a = anew;
-        alregistry.s[0] = snew;
+    struct bpage *pg = arena.head;
+    len = ( len + (MINCHUNK-1) ) & ~(MINCHUNK-1);
+    if ( ( !pg ) || ( ( pg->a - pg->u ) < len ) ) {
+        size_t pglen = BPAGE - BPAGE_HDR;
+        if ( pglen < len ) {
+            pglen = len;
+        }
+        pg = malloc( BPAGE_HDR + pglen );
+        if ( !pg ) {
+            return NULL;
+        }
+        pg->a = pglen;
+        pg->u = 0;
+        arena.held += BPAGE_HDR + pglen;
+        if ( arena.peak < arena.held ) {
+            arena.peak = arena.held;
+        }
+        if ( ( arena.head ) && ( pglen == len )
+            && ( ( arena.head->a - arena.head->u ) >= MINCHUNK ) )
+        {
+            /* An oversized, single use page, keep bumping the
+             * current one. */
+            pg->next = arena.head->next;
+            arena.head->next = pg;
+        } else {
+            pg->next = arena.head;
+            arena.head = pg;
+        }
     }
-    alregistry.s[alregistry.l++] = reg;
-    return alregistry.l;
+    void *mem = BPAGE_MEM(pg) + pg->u;
+    pg->u += len;
+    arena.total += len;
+    arena.count++;
+    return mem;
 }
 
-void
-_allocfree(const size_t reg_t)
+/* Grow the most recent allocation in place, if it fits.
+ * Returns the new length (at least newlen), or zero if it can't. */
+size_t
+_arena_extend(void *mem, size_t oldlen, size_t newlen)
 {
-    size_t unreg = ( reg_t - 1 );
-    if ( !alregistry.s ) { return; }
-    if ( alregistry.l < unreg ) { return; }
-    if ( alregistry.s[unreg] ) {
-        free( alregistry.s[unreg] );
-        alregistry.s[unreg] = (void *)0;
+    struct bpage *pg = arena.head;
+    size_t more = ( ( newlen - oldlen ) + (MINCHUNK-1) ) & ~(MINCHUNK-1);
+    if ( !pg ) { return 0; }
+    if ( ( (char *)mem + oldlen ) != ( BPAGE_MEM(pg) + pg->u ) ) {
+        return 0;
+    }
+    if ( ( pg->a - pg->u ) < more ) {
+        return 0;
     }
+    pg->u += more;
+    arena.total += more;
+    return ( oldlen + more );
 }
 
+/* Only the most recent allocation can actually be given back */
 void
-_allocfreeall()
+_arena_release(void *mem, size_t len)
 {
-    if ( !alregistry.s ) { return; }
-    if ( !alregistry.l ) { return; }
-    for( ; alregistry.l <= 0; alregistry.l-- ) {
-        if ( alregistry.s[alregistry.l] ) {
-            free( alregistry.s[alregistry.l] );
-            alregistry.s[alregistry.l] = (void *)0;
-        }
+    struct bpage *pg = arena.head;
+    if ( !pg ) { return; }
+    if ( ( (char *)mem + len ) == ( BPAGE_MEM(pg) + pg->u ) ) {
+        pg->u -= len;
     }
-    alregistry.a = 0;
 }
 
 bstr*
@@ -84,17 +122,12 @@ new_bstr(size_t len)
     #ifdef DEBUG
     fprintf(stderr, "new_bstr(%ld): requesting %ld\n", len, getlen);
     #endif
-    new = malloc( getlen );
-    memset(new, 0, getlen);
+    new = _arena_alloc( getlen );
     if ( new ) {
+        memset(new, 0, getlen);
         new->s = (char *)new + sizeof(bstr);
         new->a = getlen - sizeof(bstr);
-        if ( -1 != ( new->r = _allocreg(new) ) ) {
-            return new;
-        }
-        free(new);
-        fprintf(stderr, "Fatal: new_bstr(): Unable to register string\n");
-        return NULL;
+        return new;
     }
     fprintf(stderr, "Fatal: new_bstr(): %s\n", strerror(errno) );
     return NULL;
@@ -103,42 +136,60 @@ new_bstr(size_t len)
 void
 free_ALL_bstr()
 {
-    _allocfreeall();
+    struct bpage *pg = arena.head;
+    while ( pg ) {
+        struct bpage *next = pg->next;
+        free( pg );
+        pg = next;
+    }
+    arena.head = NULL;
+    arena.held = 0;
     return;
 }
 
 void
 free_bstr(bstr *str)
 {
-    if ( str->rs ) {
-        _allocfree(str->rs);
+    if ( str->s != ( (char *)str + sizeof(bstr) ) ) {
+        /* The string outgrew its first home */
+        _arena_release( str->s, str->a );
+    }
+    else {
+        _arena_release( str, sizeof(bstr) + str->a );
     }
-    _allocfree(str->r);
     return;
 }
 
+void
+bstr_memstats(size_t *total, size_t *peak, size_t *count)
+{
+    if ( total ) { *total = arena.total; }
+    if ( peak )  { *peak  = arena.peak; }
+    if ( count ) { *count = arena.count; }
+    return;
+}
+
+size_t
+bstr_moved()
+{
+    return arena.moved;
+}
+
 int
 strz_len_n(const char *src, int limit)
 {
-    if (!src) {
+    if ( ( !src ) || ( 0 >= limit ) ) {
         return 0;
     }
-    register const char *cx = src;
-    for( ; limit > ( cx - src ); cx++ ) {
-        if ( (char)0 == *cx ) { return ( cx - src ); }
-    }
-    return (cx - src);
+    return bscan_chr(src, limit, (char)0);
 }
 
 int
 strz_len_z(const char *src, int limit)
 {
-    if (!src) { return 0; }
-    register const char *check = src;
-    register const char *end = src + limit;
-    for( ; check < end; check++ ) {
-        if ( (char)0 == *check ) { return ( check - src ); }
-    }
+    if ( ( !src ) || ( 0 >= limit ) ) { return 0; }
+    register size_t cx = bscan_chr(src, limit, (char)0);
+    if ( cx < limit ) { return cx; }
     return 0;
 }
 
@@ -148,34 +199,42 @@ strz_len(const char *src)
     if (!src) {
         return 0;
     }
-    register const char *cx = src;
-    for( ; ; cx++ ) {
-        if ( (char)0 == *cx ) { return ( cx - src ); }
+    return bscan_len(src);
+}
+
+#ifdef DEBUG
+/* l is the length, every mutator keeps it that way, this proves it */
+int
+bstr_check(const bstr *src, const char *caller)
+{
+    if ( ( src->l >= src->a )
+        || ( (char)0 != src->s[src->l] )
+        || ( src->l != strz_len_z(src->s, src->l + 1) ) )
+    {
+        fprintf(stderr, "bstr_check(): %s(): l (%ld) is wrong for \"%s\"\n",
+            caller, src->l, src->s );
+        return 0;
     }
-    return 0;
+    return 1;
 }
+#endif
 
 int
 bstr_setlen(bstr *src, register size_t len)
 {
-    int cx = strz_len_z(src->s, src->a);
-    if ( len < cx ) {
+    if ( len < src->l ) {
         src->l = len;
-        while ( len < src->a ) {
-            src->s[len++] = (char)0;
-        }
-    } else {
-        src->l = cx;
+        src->s[len] = (char)0;
     }
+    BSTR_CHECK(src);
     return src->l;
 }
 
 int
 bstr_len(bstr *src)
 {
-    register int cx = strz_len_z(src->s, src->a);
-    src->l = cx;
-    return cx;
+    BSTR_CHECK(src);
+    return src->l;
 }
 
 int
@@ -189,83 +248,78 @@ int
 bstr_copy(bstr *dest, const bstr *src)
 {
     bstr_setlen(dest, 0);
-    return bstr_catstrz(dest, src->s, src->a);
+    return _bstr_append(dest, src->s, src->l);
 }
 
 int
 bstr_cat(bstr *dest, const bstr *src)
 {
-    return bstr_catstrz(dest, src->s, src->a);
+    return _bstr_append(dest, src->s, src->l);
 }
 
 int
 bstr_catstrz(bstr *dest, const char *src, const size_t srclimit)
 {
-    size_t dsz = bstr_len(dest);
-    size_t ssz = strz_len_n(src, srclimit);
+    return _bstr_append(dest, src, strz_len_n(src, srclimit));
+}
+
+int
+_bstr_append(bstr *dest, const char *src, size_t ssz)
+{
+    size_t dsz = dest->l;
     if ( !ssz ) {
         return dsz;
     }
     #ifdef DEBUG
-    fprintf(stderr, "bstr_catstrz( \"%s\"(%ld), \"%s\"(%ld), %ld )\n",
-        dest->s, dsz, src, ssz, srclimit );
+    fprintf(stderr, "_bstr_append( \"%s\"(%ld), \"%.*s\"(%ld) )\n",
+        dest->s, dsz, (int)ssz, src, ssz );
     #endif
-    size_t target = ( dsz + ssz );
     if ( dest->a < ( ( dsz + ssz ) + 1 ) ) {
+        /* Double, so that repeated cats stay linear */
+        size_t anew = dest->a * 2;
+        if ( anew < ( dsz + ssz + 1 ) ) {
+            anew = dsz + ssz + 1;
+        }
+        anew = ( anew + (MINCHUNK-1) ) & ~(MINCHUNK-1);
         #ifdef DEBUG
-        fprintf(stderr, "bstr_catstrz(): Requesting larger (%ld) dest\n",
-            dsz + ssz + 1 );
+        fprintf(stderr, "_bstr_append(): Requesting larger (%ld) dest\n",
+            anew );
         #endif
-        size_t holdrs = dest->rs;
-        bstr *replace = new_bstr( dsz + ssz + 1 );
-        if ( !replace ) { return 0; }
-        if ( !memcpy(replace->s, dest->s, dest->a) ) { return 0; }
-        /* dest itself AND it's string remains untouched, and we simply
-         * point dest-> to the new data.  */
-        dest->s  = replace->s;
-        dest->a  = replace->a;
-        dest->rs = replace->r;
-        if ( holdrs ) {
-            _allocfree(holdrs);
+        size_t grown = _arena_extend( dest->s, dest->a, anew );
+        if ( grown ) {
+            anew = grown;
         }
-    }
-    #ifdef DEBUG
-    fprintf(stderr, "bstr_catstrz() target len %ld\n", target);
-    #endif
-    register const char *sptr = src;
-    for ( ;dsz < target; dsz++) {
-        dest->s[dsz] = *sptr++;
-        if ( (char)0 == *sptr ) {
-            ++dsz;
-            break;
+        else {
+            char *replace = _arena_alloc( anew );
+            if ( !replace ) {
+                fprintf(stderr, "Fatal: _bstr_append(): %s\n",
+                    strerror(errno) );
+                return 0;
+            }
+            memcpy( replace, dest->s, dsz + 1 );
+            /* dest itself remains where it was, and we simply
+             * point dest-> to the new data.  */
+            dest->s = replace;
         }
+        dest->a = anew;
     }
-    dest->l = dsz;
-    ++dsz;
-    for ( ;dsz < dest->a; dsz++) {
-        dest->s[dsz] = (char)0;
-    }
+    memcpy( dest->s + dsz, src, ssz );
+    dest->l = dsz + ssz;
+    dest->s[dest->l] = (char)0;
+    BSTR_CHECK(dest);
     return dest->l;
 }
 
+/* Index of the first seek at or after start, or of the terminating
+ * NUL (l) if there is none.  -1 if start is past the end. */
 int
 bstr_index( register const char seek,
             const bstr *str,
             register int start )
 {
     if ( !str ) { return(-1); }
-    register int strlen = str->a;
-    register const char *here = (char *)(str->s + start);
-    while ( start < strlen ) {
-        if ( seek == *here ) {
-            return start;
-        }
-        else if ( (char)0 == *here ) {
-            return start;
-        }
-        ++start; ++here;
-    }
-    return -1;
+    if ( start > str->l ) { return(-1); }
+    return start + bscan_chr(str->s + start, str->l - start, seek);
 }
 
 int
@@ -301,25 +355,21 @@ bstr_splice( bstr* victim, int from, int to, bstr* dest )
     if ( !victim ) {
         return(-1);
     }
-    if ( from >= to ) {
+    /* Clamp first, so a from at or past the end is caught below */
+    if ( to > victim->l ) {
+        to = victim->l;
+    }
+    if ( ( from < 0 ) || ( from >= to ) ) {
         return(-1);
     }
-    BSFIX(victim);
     if ( dest ) {
-        bstr_catstrz(dest, victim->s + from, to - from );
-    }
-    int nz = 1;
-    while ( from < victim->a ) {
-        if ( nz ) {
-            victim->s[from++] = victim->s[to++];
-            if ( (char)0 == victim->s[to] ) {
-                nz = 0;
-                victim->l = from;
-            }
-        } else {
-            victim->s[from++] = (char)0;
-        }
+        _bstr_append(dest, victim->s + from, to - from );
     }
+    /* Includes the terminating NUL */
+    memmove( victim->s + from, victim->s + to, ( victim->l - to ) + 1 );
+    arena.moved += ( victim->l - to ) + 1;
+    victim->l -= ( to - from );
+    BSTR_CHECK(victim);
 #ifdef DEBUG
     fprintf(stderr, "bstr_splice( \"%s\"(%ld), %d, %d )\n",
         BS(victim), victim->l, from, to );
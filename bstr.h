@@ -4,8 +4,6 @@
 typedef struct {
     char *  s;
     size_t  l;
-    size_t  r;
-    size_t  rs;
     size_t  a;
 } bstr;
 
@@ -17,11 +15,16 @@ typedef struct {
 bstr *  new_bstr(size_t len);
 void    free_bstr(bstr *str);
 void    free_ALL_bstr();
+        // Arena use: bytes handed out, most bytes held, allocations
+void    bstr_memstats(size_t *total, size_t *peak, size_t *count);
+        // Bytes bstr_splice() has had to move, all time
+size_t  bstr_moved();
         // If no NULL by limit, returns zero
 int     strz_len_z(const char * src, int limit);
         // If no NULL by limit, returns limit
 int     strz_len_n(const char * src, int limit);
 int     strz_len(const char * src);
+        // O(1), l is kept current by every mutator
 int     bstr_len(bstr *src);
         // Only if newlen is smaller than src->l
 int     bstr_setlen(bstr *src, size_t newlen);
@@ -30,8 +33,11 @@ int     bstr_copystrz(bstr *dest, const char *src, const size_t srclimit);
 int     bstr_cat(bstr *dest, const bstr *src);
 int     bstr_catstrz(bstr *dest, const char *src, const size_t srclimit);
 
+        // Index of needle, or l if not found, -1 if start is past l
 int     bstr_index(const char needle, const bstr *haystack, int start);
 int     bstr_eq(const bstr *a, const bstr *b);
+        // Cut victim[from, to) (to past l is l) into dest if not NULL,
+        // the bytes cut, -1 if nothing is in range
 int     bstr_splice( bstr* victim, int from, int to, bstr* dest );
 
 #endif
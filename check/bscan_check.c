@@ -0,0 +1,213 @@
+/****************************************************************************
+ * check/bscan_check.c
+ *
+ * bscan_path() against a plain segment split: random strings of / . a b
+ * must come out as their segments joined by /, without the empty and
+ * "." ones, with a leading / if they had one, and "/" or "." if nothing
+ * is left.  Each vector search kernel this build has is also held to
+ * the scalar one on the same strings, whatever the CPU would pick.
+ * Built and run by `make check`.
+ *
+ *     bscan_check [-n STRINGS] [-s SEED]
+ *         -n  Strings to try (default 200000)
+ *         -s  Seed (default 1)
+ *
+ * Exits 1 (and prints the first few) if any answer differs.
+ *
+ * LICENSE: Same as cleanpath.c
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "configure.h"
+
+#include "bscan.h"
+
+#define STRLEN      80      // Past two AVX2 steps
+#define SHOW        10      // Mismatches printed
+
+/* The kernels behind bscan_path(), in bscan.c */
+typedef size_t (*dirty_fn)(const char *, size_t);
+size_t  _dirty_scalar(const char *src, size_t len);
+#if defined(__x86_64__) || defined(__i386__)
+#if defined(__SSE2__)
+size_t  _dirty_sse2(const char *src, size_t len);
+#if defined(HAVE_CPU_DISPATCH)
+size_t  _dirty_avx2(const char *src, size_t len);
+#endif
+#endif
+#endif
+#if defined(__aarch64__) && defined(__ARM_NEON)
+size_t  _dirty_neon(const char *src, size_t len);
+#endif
+
+struct {
+    long    strings;
+    unsigned long seed;
+    long    tried;
+    long    bad;
+} check;
+
+/* Small LCG, so a seed always makes the same cases */
+unsigned long
+_rand()
+{
+    check.seed = ( check.seed * 6364136223846793005UL ) + 1442695040888963407UL;
+    return check.seed >> 33;
+}
+
+void
+_mismatch( const char *what, const char *src, size_t len, const char *got,
+           size_t gotlen, const char *want, size_t wantlen )
+{
+    check.tried++;
+    if ( ( gotlen == wantlen ) && ( 0 == memcmp( got, want, gotlen ) ) ) {
+        return;
+    }
+    if ( check.bad++ < SHOW ) {
+        printf( "MISMATCH %s \"%.*s\": got \"%.*s\", want \"%.*s\"\n", what,
+            (int)len, src, (int)gotlen, got, (int)wantlen, want );
+    }
+    return;
+}
+
+/* What bscan.h says bscan_path() does, one segment at a time */
+size_t
+_want( const char *src, size_t len, char *out )
+{
+    size_t  l = 0;
+    size_t  cx = 0;
+
+    if ( '/' == src[0] ) {
+        out[l++] = '/';
+    }
+    while ( cx < len ) {
+        size_t sx;
+        for ( ; ( cx < len ) && ( '/' == src[cx] ); cx++ ) {
+        }
+        for ( sx = cx; ( cx < len ) && ( '/' != src[cx] ); cx++ ) {
+        }
+        if ( ( cx == sx ) || ( ( 1 == cx - sx ) && ( '.' == src[sx] ) ) ) {
+            continue;
+        }
+        if ( ( l ) && ( '/' != out[l - 1] ) ) {
+            out[l++] = '/';
+        }
+        memcpy( out + l, src + sx, cx - sx );
+        l += cx - sx;
+    }
+    if ( 0 == l ) {
+        out[l++] = '.';
+    }
+    return l;
+}
+
+void
+check_kernels( const char *src, size_t len )
+{
+    struct {
+        const char *name;
+        dirty_fn fn;
+    } kernels[] = {
+#if defined(__x86_64__) || defined(__i386__)
+#if defined(__SSE2__)
+        { "sse2", _dirty_sse2 },
+#if defined(HAVE_CPU_DISPATCH)
+        { "avx2", _dirty_avx2 },
+#endif
+#endif
+#endif
+#if defined(__aarch64__) && defined(__ARM_NEON)
+        { "neon", _dirty_neon },
+#endif
+        { NULL, NULL }
+    };
+    size_t  want = _dirty_scalar( src, len );
+    int     kx;
+
+    for ( kx = 0; kernels[kx].name; kx++ ) {
+        size_t got;
+#if defined(HAVE_CPU_DISPATCH)
+        if ( ( 0 == strcmp( "avx2", kernels[kx].name ) )
+            && ( !__builtin_cpu_supports("avx2") ) )
+        {
+            continue;
+        }
+#endif
+        got = kernels[kx].fn( src, len );
+        check.tried++;
+        if ( ( got != want ) && ( check.bad++ < SHOW ) ) {
+            printf( "MISMATCH %s \"%.*s\": %zu, scalar %zu\n",
+                kernels[kx].name, (int)len, src, got, want );
+        }
+    }
+    return;
+}
+
+void
+check_one( const char *str, size_t len )
+{
+    /* Exactly its length, so ASan sees any access past it */
+    char   *src = malloc( len );
+    char    want[STRLEN + 1];
+    size_t  wantlen;
+    size_t  got;
+
+    if ( !src ) {
+        fprintf( stderr, "Fatal: malloc()\n" );
+        exit(5);
+    }
+    memcpy( src, str, len );
+    check_kernels( src, len );
+    wantlen = _want( str, len, want );
+    got = bscan_path( src, len );
+    _mismatch( "bscan_path", str, len, src, got, want, wantlen );
+    free( src );
+    return;
+}
+
+int
+main( int argc, char *argv[] )
+{
+    const char *cases[] = {
+        "/", "//", ".", "./", "./.", ".//a", "/.", "/./", "a/", "a/.",
+        "..", "../a/..", "/.a/.b./", "a//b///c", NULL
+    };
+    char    str[STRLEN];
+    int     argcx;
+    long    sx;
+
+    check.strings = 200000;
+    check.seed = 1;
+    for ( argcx = 1; argcx < argc; argcx++ ) {
+        if ( ( 0 == strcmp( "-n", argv[argcx] ) ) && ( argcx + 1 < argc ) ) {
+            check.strings = atol( argv[++argcx] );
+        }
+        else if ( ( 0 == strcmp( "-s", argv[argcx] ) ) && ( argcx + 1 < argc ) ) {
+            check.seed = strtoul( argv[++argcx], NULL, 10 );
+        }
+        else {
+            fprintf( stderr, "Usage: %s [-n STRINGS] [-s SEED]\n", argv[0] );
+            exit(2);
+        }
+    }
+#if defined(HAVE_CPU_DISPATCH)
+    __builtin_cpu_init();
+#endif
+    for ( sx = 0; cases[sx]; sx++ ) {
+        check_one( cases[sx], strlen( cases[sx] ) );
+    }
+    for ( sx = 0; sx < check.strings; sx++ ) {
+        /* Mostly letters, or a clean stretch is never long enough */
+        size_t  len = 1 + ( _rand() % STRLEN );
+        size_t  cx;
+        for ( cx = 0; cx < len; cx++ ) {
+            unsigned long r = _rand() % 16;
+            str[cx] = ( r < 3 ) ? '/' : ( r < 5 ) ? '.' : ( r & 1 ) ? 'a' : 'b';
+        }
+        check_one( str, len );
+    }
+    printf( "%s (%s): %ld tests, %ld mismatches\n", argv[0], bscan_kernel(),
+        check.tried, check.bad );
+    return check.bad ? 1 : 0;
+}
@@ -0,0 +1,247 @@
+/****************************************************************************
+ * check/pmatch_check.c
+ *
+ * pmatch.c against fnmatch(3): random sets of patterns over a small
+ * alphabet (so that * ? [ ] ! - \ meet each other often), each tested
+ * on random strings, where pmatch_test() must say what fnmatch() of
+ * any one of the patterns says (or, for a pattern with none of * ? [ \,
+ * whether it is a prefix).  Then a few cases written out by hand.
+ * Built and run by `make check`, once as is and once with a DFA of 3
+ * states, so it starts over on nearly every step.
+ *
+ *     pmatch_check [-n SETS] [-s SEED]
+ *         -n  Pattern sets to try (default 20000)
+ *         -s  Seed (default 1)
+ *
+ * Exits 1 (and prints the first few) if any answer differs.
+ *
+ * LICENSE: Same as cleanpath.c
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fnmatch.h>
+
+#include "pmatch.h"
+
+#define PATS        4       // Most patterns in a set
+#define STRS        16      // Strings tried on each set
+#define PATLEN      8
+#define STRLEN      12
+#define SHOW        10      // Mismatches printed
+
+struct {
+    long    sets;
+    unsigned long seed;
+    long    tried;
+    long    bad;
+} check;
+
+/* One hand written case, NULL ended patterns */
+struct pcase {
+    const char *pats[4];
+    const char *str;
+    int     want;
+};
+
+/* Small LCG, so a seed always makes the same cases */
+unsigned long
+_rand()
+{
+    check.seed = ( check.seed * 6364136223846793005UL ) + 1442695040888963407UL;
+    return check.seed >> 33;
+}
+
+void
+_rand_str( char *buf, int most, const char *alpha )
+{
+    int l = _rand() % ( most + 1 );
+    int cx;
+    for ( cx = 0; cx < l; cx++ ) {
+        buf[cx] = alpha[_rand() % strlen( alpha )];
+    }
+    buf[l] = (char)0;
+    return;
+}
+
+/*
+ * Keep to what pmatch.h promises and fnmatch() agrees on: no \ in a
+ * pattern with a class (fnmatch() quotes with it inside one too), no
+ * [. [: [= (pmatch has no collating elements), and no [ without its ]
+ * (glibc does not treat it as a plain [ when a * follows).
+ */
+void
+_rand_sane( char *pat )
+{
+    char   *bx;
+    size_t  skip;
+    for ( bx = pat; *bx; bx++ ) {
+        if ( '[' != *bx ) {
+            continue;
+        }
+        if ( strchr( ".:=", bx[1] ) && ( bx[1] ) ) {
+            bx[1] = 'a';
+        }
+        skip = ( '!' == bx[1] ) ? 3 : 2;
+        if ( ( strlen( bx ) <= skip ) || ( !strchr( bx + skip, ']' ) ) ) {
+            *bx = 'b';
+        }
+    }
+    if ( strchr( pat, '[' ) ) {
+        while ( ( bx = strchr( pat, '\\' ) ) ) {
+            *bx = 'b';
+        }
+    }
+    return;
+}
+
+/* What pmatch.h says a pattern means, by way of fnmatch() */
+int
+_want( const char *pat, const char *str )
+{
+    if ( ( *pat ) && ( !strpbrk( pat, "*?[\\" ) ) ) {
+        return ( 0 == strncmp( pat, str, strlen( pat ) ) );
+    }
+    return ( 0 == fnmatch( pat, str, 0 ) );
+}
+
+void
+_compare( pmatch *pm, const char * const *pats, int n, const char *str,
+          int want )
+{
+    /* Exactly its length, so ASan sees any read past it */
+    size_t  l = strlen( str );
+    char   *copy = malloc( l + 1 );
+    int     got;
+    int     px;
+
+    if ( !copy ) {
+        fprintf( stderr, "Fatal: malloc()\n" );
+        exit(5);
+    }
+    memcpy( copy, str, l + 1 );
+    got = pmatch_test( pm, copy, l );
+    free( copy );
+    check.tried++;
+    if ( got == want ) {
+        return;
+    }
+    if ( check.bad++ < SHOW ) {
+        printf( "MISMATCH \"%s\": pmatch %d, want %d, patterns:", str, got,
+            want );
+        for ( px = 0; px < n; px++ ) {
+            printf( " \"%s\"", pats[px] );
+        }
+        printf( "\n" );
+    }
+    return;
+}
+
+void
+check_random()
+{
+    char    pbuf[PATS][PATLEN + 1];
+    const char *pats[PATS];
+    char    str[STRLEN + 1];
+    long    sx;
+
+    for ( sx = 0; sx < check.sets; sx++ ) {
+        int n = 1 + ( _rand() % PATS );
+        int px;
+        int tx;
+        pmatch *pm;
+        for ( px = 0; px < n; px++ ) {
+            /* Backslash only before a byte, as fnmatch() wants it */
+            _rand_str( pbuf[px], PATLEN, "ab/.*?*[]!-" );
+            if ( ( 0 == ( _rand() % 4 ) ) && ( pbuf[px][0] ) ) {
+                pbuf[px][_rand() % strlen( pbuf[px] )] = '\\';
+                if ( '\\' == pbuf[px][strlen( pbuf[px] ) - 1] ) {
+                    pbuf[px][strlen( pbuf[px] ) - 1] = 'a';
+                }
+            }
+            _rand_sane( pbuf[px] );
+            pats[px] = pbuf[px];
+        }
+        pm = pmatch_new( pats, n );
+        if ( !pm ) {
+            fprintf( stderr, "Fatal: pmatch_new()\n" );
+            exit(5);
+        }
+        for ( tx = 0; tx < STRS; tx++ ) {
+            int want = 0;
+            _rand_str( str, STRLEN, "ab/.-]![" );
+            for ( px = 0; px < n; px++ ) {
+                want |= _want( pats[px], str );
+            }
+            _compare( pm, pats, n, str, want );
+        }
+        pmatch_free( pm );
+    }
+    return;
+}
+
+void
+check_cases()
+{
+    struct pcase cases[] = {
+        /* An empty pattern is not a prefix of everything */
+        { { "", NULL },                     "/usr/bin",         0 },
+        { { "", NULL },                     "",                 1 },
+        { { "", "/mnt/", NULL },            "/mnt/x",           1 },
+        { { "/mnt/stale/", NULL },          "/mnt/stale/bin",   1 },
+        { { "/mnt/stale/", NULL },          "/mnt/stale",       0 },
+        { { "*/node_modules/.bin", NULL },  "/a/b/node_modules/.bin", 1 },
+        { { "*/node_modules/.bin", NULL },  "/a/node_modules/.bin/x", 0 },
+        { { "/opt/*/bin", "/x", NULL },     "/opt/a/b/bin",     1 },
+        { { "[!/]*", NULL },                "rel/bin",          1 },
+        { { "[!/]*", NULL },                "/abs",             0 },
+        { { "/a[", NULL },                  "/a[",              1 },
+        { { "/a\\*", NULL },                "/a*",              1 },
+        { { "/a\\*", NULL },                "/ab",              0 },
+        { { "[]a]", NULL },                 "]",                1 },
+        { { "/a?c", NULL },                 "/a/c",             1 },
+    };
+    size_t  cx;
+
+    for ( cx = 0; cx < sizeof(cases) / sizeof(cases[0]); cx++ ) {
+        int n = 0;
+        pmatch *pm;
+        while ( cases[cx].pats[n] ) {
+            n++;
+        }
+        pm = pmatch_new( cases[cx].pats, n );
+        if ( !pm ) {
+            fprintf( stderr, "Fatal: pmatch_new()\n" );
+            exit(5);
+        }
+        _compare( pm, cases[cx].pats, n, cases[cx].str, cases[cx].want );
+        pmatch_free( pm );
+    }
+    return;
+}
+
+int
+main( int argc, char *argv[] )
+{
+    int argcx;
+
+    check.sets = 20000;
+    check.seed = 1;
+    for ( argcx = 1; argcx < argc; argcx++ ) {
+        if ( ( 0 == strcmp( "-n", argv[argcx] ) ) && ( argcx + 1 < argc ) ) {
+            check.sets = atol( argv[++argcx] );
+        }
+        else if ( ( 0 == strcmp( "-s", argv[argcx] ) ) && ( argcx + 1 < argc ) ) {
+            check.seed = strtoul( argv[++argcx], NULL, 10 );
+        }
+        else {
+            fprintf( stderr, "Usage: %s [-n SETS] [-s SEED]\n", argv[0] );
+            exit(2);
+        }
+    }
+    check_random();
+    check_cases();
+    printf( "%s: %ld tests, %ld mismatches\n", argv[0], check.tried,
+        check.bad );
+    return check.bad ? 1 : 0;
+}
@@ -0,0 +1,276 @@
+/****************************************************************************
+ * check/scache_check.c
+ *
+ * scache.c with several writers at once: processes that share one
+ * cache file (in a temp XDG_RUNTIME_DIR) all store and look up the
+ * same few paths, picked so they fall on the same slots, and each path
+ * always has the same made-up stat() result.  Any lookup that comes
+ * back with another path's mode, dev or ino (a slot two writers tore)
+ * is counted.  Built and run by `make check`, once as is and once with
+ * SCACHE_STUCK 0, so every slot found mid-write is taken over at once.
+ *
+ * Writers on one CPU almost never stop mid-write, so first the slots
+ * are set up by hand as a writer leaves them: one that claimed a slot
+ * this second (its old entry long expired) must be left alone, and one
+ * that stalled past SCACHE_STUCK and then goes on storing over the
+ * writer that took over must not make a lookup that passes.
+ *
+ *     scache_check [-w WRITERS] [-t SECONDS]
+ *         -w  Processes (default 4)
+ *         -t  How long they run (default 2)
+ *
+ * Exits 1 if any lookup was torn.
+ *
+ * LICENSE: Same as cleanpath.c
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+/* All of it, for the slot layout */
+#include "scache.c"
+
+#define PATHS       12      // Three for each of the 4 ways
+#define PATHLEN     48
+
+struct {
+    int     writers;
+    int     seconds;
+    char    dir[64];
+    char    path[PATHS][PATHLEN];
+} check;
+
+/* The one answer each path ever gets */
+void
+_expect( int px, struct tstat *ts )
+{
+    memset( ts, 0, sizeof(*ts) );
+    ts->ret  = ( px & 1 ) ? -1 : 0;
+    ts->err  = ( px & 1 ) ? 2 : 0;
+    ts->mode = 040000 | px;
+    ts->dev  = 1000 + px;
+    ts->ino  = 7919 * ( px + 1 );
+    return;
+}
+
+/* PATHS paths whose first way is the same slot */
+void
+make_paths()
+{
+    uint64_t want = 0;
+    long    n;
+    int     px = 0;
+
+    for ( n = 0; px < PATHS; n++ ) {
+        char    p[PATHLEN];
+        uint64_t key;
+        snprintf( p, sizeof(p), "/scache/check/%ld", n );
+        key = _scache_key( p, strlen( p ) ) & ( SCACHE_SLOTS - 1 );
+        if ( !px ) {
+            want = key;
+        }
+        if ( key == want ) {
+            strcpy( check.path[px++], p );
+        }
+    }
+    return;
+}
+
+/* What a writer does to a slot the moment its claim CAS succeeds */
+void
+_claim( struct scache_slot *slot, int64_t when )
+{
+    slot->seq = ( (uint64_t)(uint32_t)when << 32 )
+              | (uint32_t)( ( slot->seq | 1 ) + 2 );
+    return;
+}
+
+/* The hand made cases, the number that went wrong */
+int
+check_claims()
+{
+    uint64_t key = _scache_key( check.path[0], strlen( check.path[0] ) );
+    uint64_t newkey = _scache_key( check.path[SCACHE_WAYS],
+                                   strlen( check.path[SCACHE_WAYS] ) );
+    struct scache_slot *slot = &scache.map->slot[key & ( SCACHE_SLOTS - 1 )];
+    struct scache_slot before[SCACHE_WAYS];
+    struct tstat want;
+    struct tstat got;
+    int64_t now = time( NULL );
+    int     px;
+    int     bad = 0;
+
+    /* path[0..3] fill the 4 ways, then all of them go stale and are
+     * claimed by live writers */
+    for ( px = 0; px < SCACHE_WAYS; px++ ) {
+        _expect( px, &want );
+        scache_put( check.path[px], &want );
+    }
+    for ( px = 0; px < SCACHE_WAYS; px++ ) {
+        slot[px].when = now - 100;
+        slot[px].sum  = _scache_sum( &slot[px] );
+        _claim( &slot[px], now );
+    }
+    memcpy( before, slot, sizeof(before) );
+    _expect( SCACHE_WAYS, &want );
+    scache_put( check.path[SCACHE_WAYS], &want );
+    if ( memcmp( before, slot, sizeof(before) ) ) {
+        printf( "TAKEN: a slot claimed this second went to another writer\n" );
+        bad++;
+    }
+
+    /* Now the claims are old, their writers stalled */
+    for ( px = 0; px < SCACHE_WAYS; px++ ) {
+        _claim( &slot[px], now - SCACHE_STUCK - 1 );
+    }
+    scache_put( check.path[SCACHE_WAYS], &want );
+    if ( ( !scache_get( check.path[SCACHE_WAYS], &got, 3600 ) )
+        || ( got.ino != want.ino ) )
+    {
+        printf( "STUCK: a slot claimed long ago was not taken over\n" );
+        bad++;
+    }
+    /* The stalled writer wakes up and stores the rest of path[0]'s,
+     * over what the new writer published */
+    _expect( 0, &want );
+    for ( px = 0; px < SCACHE_WAYS; px++ ) {
+        if ( slot[px].key == newkey ) {
+            slot[px].mode = want.mode;
+            slot[px].dev  = want.dev;
+            slot[px].ino  = want.ino;
+        }
+    }
+    if ( ( scache_get( check.path[0], &got, 3600 ) )
+        || ( scache_get( check.path[SCACHE_WAYS], &got, 3600 ) ) )
+    {
+        printf( "TORN: a slot two writers stored into was taken as good\n" );
+        bad++;
+    }
+    printf( "claims: %s\n", bad ? "FAILED" : "ok" );
+    return bad;
+}
+
+/* One process, 1 if it ever saw a torn slot */
+int
+writer( int wx )
+{
+    unsigned long seed = 12345 + wx;
+    time_t  end = time( NULL ) + check.seconds;
+    long    puts = 0;
+    long    hits = 0;
+    long    torn = 0;
+
+    if ( scache_open() ) {
+        fprintf( stderr, "Fatal: scache_open()\n" );
+        return 5;
+    }
+    while ( time( NULL ) < end ) {
+        int     rx;
+        for ( rx = 0; rx < 1000; rx++ ) {
+            struct tstat want;
+            struct tstat got;
+            int     px;
+            seed = ( seed * 6364136223846793005UL ) + 1442695040888963407UL;
+            px = ( seed >> 33 ) % PATHS;
+            _expect( px, &want );
+            if ( ( seed >> 40 ) & 1 ) {
+                scache_put( check.path[px], &want );
+                puts++;
+                continue;
+            }
+            if ( !scache_get( check.path[px], &got, 3600 ) ) {
+                continue;
+            }
+            hits++;
+            if ( ( got.ret != want.ret ) || ( got.err != want.err )
+                || ( got.mode != want.mode ) || ( got.dev != want.dev )
+                || ( got.ino != want.ino ) )
+            {
+                if ( !torn++ ) {
+                    printf( "TORN %s: mode %o dev %lu ino %lu\n",
+                        check.path[px], (unsigned)got.mode,
+                        (unsigned long)got.dev, (unsigned long)got.ino );
+                }
+            }
+        }
+    }
+    printf( "writer %d: %ld puts, %ld hits, %ld torn\n", wx, puts, hits,
+        torn );
+    return torn ? 1 : 0;
+}
+
+int
+main( int argc, char *argv[] )
+{
+    char    file[128];
+    int     argcx;
+    int     wx;
+    int     bad = 0;
+
+    check.writers = 4;
+    check.seconds = 2;
+    for ( argcx = 1; argcx < argc; argcx++ ) {
+        if ( ( 0 == strcmp( "-w", argv[argcx] ) ) && ( argcx + 1 < argc ) ) {
+            check.writers = atoi( argv[++argcx] );
+        }
+        else if ( ( 0 == strcmp( "-t", argv[argcx] ) ) && ( argcx + 1 < argc ) ) {
+            check.seconds = atoi( argv[++argcx] );
+        }
+        else {
+            fprintf( stderr, "Usage: %s [-w WRITERS] [-t SECONDS]\n", argv[0] );
+            exit(2);
+        }
+    }
+    if ( check.writers < 2 ) {
+        check.writers = 2;
+    }
+    strcpy( check.dir, "/tmp/scache_check.XXXXXX" );
+    if ( !mkdtemp( check.dir ) ) {
+        perror( "Fatal: mkdtemp()" );
+        exit(5);
+    }
+    setenv( "XDG_RUNTIME_DIR", check.dir, 1 );
+    make_paths();
+#if SCACHE_STUCK
+    if ( scache_open() ) {
+        fprintf( stderr, "Fatal: scache_open()\n" );
+        exit(5);
+    }
+    bad = check_claims();
+    /* The writers start on an empty cache */
+    memset( scache.map->slot, 0, sizeof(scache.map->slot) );
+#endif
+
+    fflush( stdout );
+    for ( wx = 0; wx < check.writers; wx++ ) {
+        pid_t pid = fork();
+        if ( 0 > pid ) {
+            perror( "Fatal: fork()" );
+            exit(5);
+        }
+        if ( 0 == pid ) {
+            int rc = writer( wx );
+            fflush( stdout );
+            _exit( rc );
+        }
+    }
+    for ( wx = 0; wx < check.writers; wx++ ) {
+        int status;
+        if ( ( 0 > wait( &status ) ) || ( !WIFEXITED(status) )
+            || ( WEXITSTATUS(status) ) )
+        {
+            bad++;
+        }
+    }
+    snprintf( file, sizeof(file), "%s/cleanpath-stat.cache", check.dir );
+    unlink( file );
+    rmdir( check.dir );
+    printf( "%s: %d writers, %s\n", argv[0], check.writers,
+        bad ? "TORN" : "no torn slots" );
+    return bad ? 1 : 0;
+}
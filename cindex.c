@@ -0,0 +1,533 @@
+#define CINDEX_VERSION "0.01"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "configure.h"
+
+#include "bhash.h"
+#include "tstat.h"
+#include "cindex.h"
+
+#define CINDEX_MAGIC    0x58495043u     // "CPIX"
+#define CINDEX_FORMAT   1
+#define CINDEX_FILE     "cleanpath-cmd"
+
+/*
+ * The file, and an index built in memory, are one block: this head,
+ * then the directories, the slots, and the strings (the list, NUL,
+ * then each command name, NUL).  Offsets are from the head.
+ */
+struct cindex_head {
+    uint32_t    magic;
+    uint32_t    format;
+    uint64_t    size;       // Whole block
+    int64_t     checked;    // time() the mtimes last matched, in place
+    uint32_t    racy;       // A directory changed the second it was read
+    uint32_t    delim;
+    uint32_t    listlen;
+    uint32_t    ndirs;
+    uint32_t    nslots;     // Power of two
+    uint32_t    ncmds;
+    uint64_t    dirs_off;
+    uint64_t    slots_off;
+    uint64_t    strs_off;
+};
+
+struct cindex_dir {
+    int64_t     mtime;      // -1 if it could not be stat()ed
+    uint64_t    dev;
+    uint64_t    ino;
+    uint32_t    off;        // Of its name, in the list
+    uint32_t    len;
+};
+
+struct cindex_slot {
+    uint32_t    h;
+    uint32_t    off;        // Of the command name, 0 for an empty slot
+    uint32_t    len;
+    uint32_t    dir;
+};
+
+/* While building: the pieces, each grown on its own */
+struct cindex_build {
+    struct cindex_dir *dirs;
+    int         ndirs;
+    struct cindex_slot *slots;
+    uint32_t    nslots;
+    uint32_t    ncmds;
+    char *      strs;
+    size_t      sl;
+    size_t      sa;
+    int         racy;
+};
+
+#define CINDEX_DIRS(hd)  ( (const struct cindex_dir *)( (const char *)(hd) + (hd)->dirs_off ) )
+#define CINDEX_SLOTS(hd) ( (const struct cindex_slot *)( (const char *)(hd) + (hd)->slots_off ) )
+#define CINDEX_STRS(hd)  ( (const char *)(hd) + (hd)->strs_off )
+
+uint64_t
+_cindex_key( const char *list, size_t len, char delim )
+{
+    /* FNV-1a, 64 bit, of the delimiter and the list */
+    register uint64_t h = 14695981039346656037ull;
+    register const unsigned char *cx = (const unsigned char *)list;
+    register const unsigned char *end = cx + len;
+    h ^= (unsigned char)delim;
+    h *= 1099511628211ull;
+    for ( ; cx < end; cx++ ) {
+        h ^= *cx;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+/*
+ * Slot of name, or the empty slot it would go in.  NULL if the slots
+ * are not sane (a name past strl, the strs in use, or no empty slot),
+ * which only a damaged file can have.
+ */
+const struct cindex_slot *
+_cindex_slot( const struct cindex_slot *slots, uint32_t nslots,
+              const char *strs, size_t strl, const char *name, size_t len,
+              uint32_t h )
+{
+    uint32_t cx = h & ( nslots - 1 );
+    uint32_t seen;
+    for ( seen = 0; slots[cx].off; seen++ ) {
+        if ( ( seen == nslots )
+            || ( (uint64_t)slots[cx].off + slots[cx].len > strl ) )
+        {
+            return NULL;
+        }
+        if ( ( slots[cx].h == h ) && ( slots[cx].len == len )
+            && ( 0 == memcmp( strs + slots[cx].off, name, len ) ) )
+        {
+            break;
+        }
+        cx = ( cx + 1 ) & ( nslots - 1 );
+    }
+    return &slots[cx];
+}
+
+int
+_cindex_strs( struct cindex_build *b, const char *s, size_t len )
+{
+    if ( ( b->sl + len + 1 ) > b->sa ) {
+        size_t a = b->sa ? b->sa : 65536;
+        char *grow;
+        while ( a < ( b->sl + len + 1 ) ) {
+            a *= 2;
+        }
+        grow = realloc( b->strs, a );
+        if ( !grow ) {
+            return -1;
+        }
+        b->strs = grow;
+        b->sa = a;
+    }
+    memcpy( b->strs + b->sl, s, len );
+    b->strs[b->sl + len] = (char)0;
+    b->sl += len + 1;
+    return 0;
+}
+
+/* Double the slots, keeping the load under one half */
+int
+_cindex_grow( struct cindex_build *b )
+{
+    uint32_t nslots = b->nslots ? ( 2 * b->nslots ) : 1024;
+    struct cindex_slot *slots = calloc( nslots, sizeof(struct cindex_slot) );
+    uint32_t cx;
+    if ( !slots ) {
+        return -1;
+    }
+    for ( cx = 0; cx < b->nslots; cx++ ) {
+        if ( b->slots[cx].off ) {
+            uint32_t to = b->slots[cx].h & ( nslots - 1 );
+            while ( slots[to].off ) {
+                to = ( to + 1 ) & ( nslots - 1 );
+            }
+            slots[to] = b->slots[cx];
+        }
+    }
+    free( b->slots );
+    b->slots  = slots;
+    b->nslots = nslots;
+    return 0;
+}
+
+/* Every command of one directory that an earlier one does not have */
+int
+_cindex_dir( struct cindex_build *b, int dx, const char *dir, time_t now )
+{
+    struct cindex_dir *d = &b->dirs[dx];
+    struct stat st;
+    struct dirent *de;
+    DIR    *dh;
+
+    d->mtime = -1;
+    if ( stat( dir, &st ) ) {
+        return 0;
+    }
+    d->mtime = st.st_mtime;
+    d->dev   = st.st_dev;
+    d->ino   = st.st_ino;
+    if ( st.st_mtime >= now ) {
+        /* It could change again this second, unseen by the mtime */
+        b->racy = 1;
+    }
+    dh = opendir( dir );
+    if ( !dh ) {
+        return 0;
+    }
+    while ( ( de = readdir( dh ) ) ) {
+        const char *name = de->d_name;
+        size_t l;
+        uint32_t h;
+        struct cindex_slot *slot;
+        if ( ( DT_DIR == de->d_type ) || ( 0 == strcmp( ".", name ) )
+            || ( 0 == strcmp( "..", name ) ) )
+        {
+            continue;
+        }
+        l = strlen( name );
+        h = bhash_sum( name, l );
+        slot = (struct cindex_slot *)_cindex_slot( b->slots, b->nslots,
+                    b->strs, b->sl, name, l, h );
+        if ( slot->off ) {
+            /* An earlier directory wins */
+            continue;
+        }
+        if ( !tstat_command( dirfd( dh ), name, de->d_type ) ) {
+            continue;
+        }
+        slot->h   = h;
+        slot->off = b->sl;
+        slot->len = l;
+        slot->dir = dx;
+        if ( _cindex_strs( b, name, l ) ) {
+            closedir( dh );
+            return -1;
+        }
+        if ( ( ++b->ncmds * 2 ) > b->nslots ) {
+            if ( _cindex_grow( b ) ) {
+                closedir( dh );
+                return -1;
+            }
+        }
+    }
+    closedir( dh );
+    return 0;
+}
+
+/* The whole index for list, as one malloc()ed block */
+struct cindex_head *
+_cindex_build( const char *list, size_t listlen, char delim )
+{
+    struct cindex_build b;
+    struct cindex_head *hd = NULL;
+    time_t now = time( NULL );
+    size_t start;
+    size_t end;
+    int    dx;
+
+    memset( &b, 0, sizeof(b) );
+    b.dirs = malloc( ( listlen / 2 + 1 ) * sizeof(struct cindex_dir) );
+    if ( ( !b.dirs ) || _cindex_grow( &b )
+        || _cindex_strs( &b, list, listlen ) )
+    {
+        goto done;
+    }
+    for ( start = 0; start < listlen; start = end + 1 ) {
+        for ( end = start; ( end < listlen ) && ( delim != list[end] ); end++ ) {
+        }
+        if ( end > start ) {
+            b.dirs[b.ndirs].off = start;
+            b.dirs[b.ndirs].len = end - start;
+            b.ndirs++;
+        }
+    }
+    for ( dx = 0; dx < b.ndirs; dx++ ) {
+        char *dir = strndup( list + b.dirs[dx].off, b.dirs[dx].len );
+        int bad = ( !dir ) || _cindex_dir( &b, dx, dir, now );
+        free( dir );
+        if ( bad ) {
+            goto done;
+        }
+    }
+
+    size_t dirs_off  = ( sizeof(struct cindex_head) + 7 ) & ~(size_t)7;
+    size_t slots_off = dirs_off + ( b.ndirs * sizeof(struct cindex_dir) );
+    size_t strs_off  = slots_off + ( b.nslots * sizeof(struct cindex_slot) );
+    hd = calloc( 1, strs_off + b.sl );
+    if ( !hd ) {
+        goto done;
+    }
+    hd->magic     = CINDEX_MAGIC;
+    hd->format    = CINDEX_FORMAT;
+    hd->size      = strs_off + b.sl;
+    hd->checked   = now;
+    hd->racy      = b.racy;
+    hd->delim     = (unsigned char)delim;
+    hd->listlen   = listlen;
+    hd->ndirs     = b.ndirs;
+    hd->nslots    = b.nslots;
+    hd->ncmds     = b.ncmds;
+    hd->dirs_off  = dirs_off;
+    hd->slots_off = slots_off;
+    hd->strs_off  = strs_off;
+    memcpy( (char *)hd + dirs_off, b.dirs, b.ndirs * sizeof(struct cindex_dir) );
+    memcpy( (char *)hd + slots_off, b.slots, b.nslots * sizeof(struct cindex_slot) );
+    memcpy( (char *)hd + strs_off, b.strs, b.sl );
+done:
+    free( b.dirs );
+    free( b.slots );
+    free( b.strs );
+    return hd;
+}
+
+/*
+ * 1 if hd is an index of list and (as far as ttl asks) still right.
+ * Every offset in the head and the directories is checked against the
+ * block here, the slots as _cindex_probe() walks them, so a damaged
+ * file (cut short, or from a build that wrote it differently) can not
+ * send a read outside the map.
+ */
+int
+_cindex_valid( struct cindex_head *hd, size_t size, const char *list,
+               size_t listlen, char delim, int ttl )
+{
+    const struct cindex_dir *dirs;
+    time_t now = time( NULL );
+    uint32_t dx;
+
+    if ( ( sizeof(struct cindex_head) > size )
+        || ( CINDEX_MAGIC != hd->magic ) || ( CINDEX_FORMAT != hd->format )
+        || ( size != hd->size ) || ( (unsigned char)delim != hd->delim )
+        || ( listlen != hd->listlen ) || ( hd->racy )
+        /* Each no more than size, so the sums below can not wrap */
+        || ( hd->dirs_off < sizeof(struct cindex_head) )
+        || ( hd->dirs_off & 7 ) || ( hd->dirs_off > size )
+        || ( hd->slots_off > size ) || ( hd->strs_off > size )
+        || ( hd->dirs_off + ( hd->ndirs * sizeof(struct cindex_dir) )
+                > hd->slots_off )
+        || ( hd->slots_off + ( (uint64_t)hd->nslots
+                * sizeof(struct cindex_slot) ) > hd->strs_off )
+        || ( ( !hd->nslots ) || ( hd->nslots & ( hd->nslots - 1 ) ) )
+        || ( hd->strs_off + listlen >= size )
+        || ( memcmp( CINDEX_STRS(hd), list, listlen ) ) )
+    {
+        return 0;
+    }
+    dirs = CINDEX_DIRS(hd);
+    for ( dx = 0; dx < hd->ndirs; dx++ ) {
+        if ( ( !dirs[dx].len )
+            || ( (uint64_t)dirs[dx].off + dirs[dx].len > listlen ) )
+        {
+            return 0;
+        }
+    }
+    /* A relative directory is another one from another working
+     * directory, so those lists are always checked */
+    for ( dx = 0; ( 0 < ttl ) && ( dx < hd->ndirs ); dx++ ) {
+        if ( '/' != list[dirs[dx].off] ) {
+            ttl = 0;
+        }
+    }
+    if ( ( 0 < ttl ) && ( hd->checked <= now )
+        && ( ( now - hd->checked ) < ttl ) )
+    {
+        return 1;
+    }
+    for ( dx = 0; dx < hd->ndirs; dx++ ) {
+        struct stat st;
+        char *dir = strndup( list + dirs[dx].off, dirs[dx].len );
+        int gone;
+        if ( !dir ) {
+            return 0;
+        }
+        gone = stat( dir, &st );
+        free( dir );
+        if ( gone ) {
+            if ( -1 != dirs[dx].mtime ) {
+                return 0;
+            }
+        }
+        else if ( ( dirs[dx].mtime != st.st_mtime )
+            || ( dirs[dx].dev != st.st_dev ) || ( dirs[dx].ino != st.st_ino )
+            || ( st.st_mtime >= now ) )
+        {
+            return 0;
+        }
+    }
+    __atomic_store_n( &hd->checked, (int64_t)now, __ATOMIC_RELAXED );
+    return 1;
+}
+
+/* Written aside and renamed over, so a reader only ever maps a whole one */
+void
+_cindex_write( const char *file, const struct cindex_head *hd )
+{
+    char  *tmp = malloc( strlen( file ) + 32 );
+    int    fd;
+    int    bad;
+
+    if ( !tmp ) {
+        return;
+    }
+    sprintf( tmp, "%s.%ld", file, (long)getpid() );
+    fd = open( tmp, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, 0600 );
+    if ( 0 > fd ) {
+        free( tmp );
+        return;
+    }
+    bad = ( (ssize_t)hd->size != write( fd, hd, hd->size ) );
+    bad |= close( fd );
+    if ( bad || rename( tmp, file ) ) {
+        unlink( tmp );
+    }
+    free( tmp );
+    return;
+}
+
+/* 1 and buf, 0 if not found, -1 (ERANGE, or EINVAL if hd is damaged) */
+int
+_cindex_probe( const struct cindex_head *hd, const char *name,
+               char *buf, size_t bufl )
+{
+    size_t l = strlen( name );
+    const struct cindex_slot *slot = _cindex_slot( CINDEX_SLOTS(hd),
+            hd->nslots, CINDEX_STRS(hd), hd->size - hd->strs_off, name, l,
+            bhash_sum( name, l ) );
+    const struct cindex_dir *dir;
+
+    if ( ( !slot ) || ( ( slot->off ) && ( slot->dir >= hd->ndirs ) ) ) {
+        errno = EINVAL;
+        return -1;
+    }
+    if ( !slot->off ) {
+        return 0;
+    }
+    dir = &CINDEX_DIRS(hd)[slot->dir];
+    if ( (size_t)snprintf( buf, bufl, "%.*s/%s", (int)dir->len,
+            CINDEX_STRS(hd) + dir->off, name ) >= bufl )
+    {
+        errno = ERANGE;
+        return -1;
+    }
+    return 1;
+}
+
+/* No place to keep an index, so the plain way: each directory in turn */
+int
+_cindex_walk( const char *list, size_t listlen, char delim,
+              const char *name, char *buf, size_t bufl )
+{
+    size_t start;
+    size_t end;
+    for ( start = 0; start < listlen; start = end + 1 ) {
+        for ( end = start; ( end < listlen ) && ( delim != list[end] ); end++ ) {
+        }
+        if ( end == start ) {
+            continue;
+        }
+        if ( (size_t)snprintf( buf, bufl, "%.*s/%s", (int)( end - start ),
+                list + start, name ) >= bufl )
+        {
+            errno = ERANGE;
+            return -1;
+        }
+        if ( tstat_command( AT_FDCWD, buf, DT_UNKNOWN ) ) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int
+cindex_which( const char *list, char delim, const char *name, int ttl,
+              char *buf, size_t bufl )
+{
+    char   *xdg = getenv("XDG_RUNTIME_DIR");
+    size_t  listlen = list ? strlen( list ) : 0;
+    char   *file = NULL;
+    struct cindex_head *hd;
+    struct stat st;
+    int     fd;
+    int     found;
+
+    if ( ( !*name ) || strchr( name, '/' ) ) {
+        /* A path is not looked up, as in a shell */
+        if ( ( !*name ) || ( !tstat_command( AT_FDCWD, name, DT_UNKNOWN ) ) ) {
+            return 0;
+        }
+        if ( (size_t)snprintf( buf, bufl, "%s", name ) >= bufl ) {
+            errno = ERANGE;
+            return -1;
+        }
+        return 1;
+    }
+
+    if ( ( !xdg ) || ( '/' != *xdg ) ) {
+        return _cindex_walk( list ? list : "", listlen, delim, name,
+                    buf, bufl );
+    }
+    file = malloc( strlen( xdg ) + strlen( CINDEX_FILE ) + 20 );
+    if ( !file ) {
+        return -1;
+    }
+    sprintf( file, "%s/%s.%016llx", xdg, CINDEX_FILE,
+        (unsigned long long)_cindex_key( list ? list : "", listlen, delim ) );
+    fd = open( file, O_RDWR | O_NOFOLLOW );
+    /* Only ever trust an index this user made */
+    if ( ( 0 <= fd ) && ( 0 == fstat( fd, &st ) )
+        && ( st.st_uid == getuid() ) && S_ISREG( st.st_mode )
+        && ( sizeof(struct cindex_head) <= (size_t)st.st_size ) )
+    {
+        hd = mmap( NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                fd, 0 );
+        if ( MAP_FAILED != (void *)hd ) {
+            if ( _cindex_valid( hd, st.st_size, list ? list : "", listlen,
+                    delim, ttl ) )
+            {
+                found = _cindex_probe( hd, name, buf, bufl );
+                /* A damaged one is built again, below */
+                if ( ( -1 == found ) && ( EINVAL == errno ) ) {
+                    found = 0;
+                }
+                else {
+                    munmap( hd, st.st_size );
+                    close( fd );
+                    free( file );
+                    return found;
+                }
+            }
+            munmap( hd, st.st_size );
+        }
+    }
+    if ( 0 <= fd ) {
+        close( fd );
+    }
+
+    /* Missing or stale, build it, answer from it, and keep it */
+    hd = _cindex_build( list ? list : "", listlen, delim );
+    if ( !hd ) {
+        free( file );
+        errno = ENOMEM;
+        return -1;
+    }
+    _cindex_write( file, hd );
+    found = _cindex_probe( hd, name, buf, bufl );
+    free( hd );
+    free( file );
+    return found;
+}
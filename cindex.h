@@ -0,0 +1,24 @@
+#ifndef VOLLINK_CINDEX_H
+#define VOLLINK_CINDEX_H
+
+#include <stddef.h>
+
+/*
+ * Every command reachable through one (already cleaned) PATH, with the
+ * directory that wins for each, in a file under XDG_RUNTIME_DIR that
+ * is memory-mapped to look a name up with one hash probe.  The file is
+ * named by a hash of the list, holds the list itself and each
+ * directory's mtime, and is rebuilt (written aside, then renamed over)
+ * when either no longer matches.  With ttl, an index checked less than
+ * ttl seconds ago is trusted without a stat() of each directory, unless
+ * one of them is relative.  A chmod of a file that is already there
+ * does not change the mtime, so it is not seen until something else in
+ * that directory changes.
+ */
+
+        // Full path of name into buf, 1 if found, 0 if not, -1 on error
+        // (errno).  Without XDG_RUNTIME_DIR the directories are walked.
+int     cindex_which( const char *list, char delim, const char *name,
+                      int ttl, char *buf, size_t bufl );
+
+#endif
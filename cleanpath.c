@@ -15,25 +15,128 @@
 // stat()
 #include <sys/types.h>
 #include <unistd.h>
+#include <fcntl.h>          // open, for --input
+#include <time.h>           // clock_gettime, for --stats
 #include "configure.h"
+#ifdef CP_BUILTIN
+#include <setjmp.h>
+#endif
 
 #include "bstr.h"
+#include "bscan.h"
+#include "cleanpath.h"
+#include "trace.h"
+
+/* Events --trace can hold, past that the oldest are dropped */
+#define TRACE_EVENTS 65536
+
+/* --union, --minus or --intersect: more lists, by ENVNAME (--remove
+ * keeps its patterns in name) */
+struct envset {
+    const char **name;      // NULL ended
+    const char **value;     // By pull_sets(), NULL ended
+    int     n;
+    int     a;
+};
 
 struct options {
     int     exist;
     int     file;
     int     dir;
+    int     samefile;
+    int     prune;      // 1 --prune, 2 --prune-report
+    int     prune_max;
+    int     normalize;  // 1 --normalize, 2 --normalize-output
     int     before;
     int     debug;
+    int     jobs;
+    int     uring;
+    int     ttl;
+    int     memo;
+    int     stats;
 #ifndef NO_ARG_MAX
     int     sizewarn;
 #endif
     char    delimiter;
+    char    *input;     // --stdin ("-") or --input FILE, else NULL
+    char    *trace;     // --trace FILE, else NULL
+    char    *which;     // --which NAME, else NULL
+    struct envset unions;
+    struct envset minus;
+    struct envset isect;
+    struct envset remove;
     bstr    *env;
     bstr    *extra;
+    bstr    *joined;    // ENVNAME's value and each --union's
+};
+
+/* One ENVNAME of a --batch run */
+struct envjob {
+    struct options   opt;
+    struct cleanpath cp;
 };
 
-bstr *  tokenwalk( struct options *opt, bstr *whole );
+/* --stats: the command's own phases, libcleanpath's summed over runs */
+struct {
+    unsigned long long start;
+    unsigned long long check_opt_ns;
+    unsigned long long env_ns;      // Reading ENVNAME
+    unsigned long long output_ns;
+    size_t  count0;     // bstr arena as it was at start
+    size_t  total0;
+    size_t  moved0;
+    const char *trace;  // --trace FILE, written by myexit()
+    struct cleanpath_count lib;
+} runstats;
+
+/*
+ * What this run has allocated, for myexit() to free before a builtin
+ * goes back to the shell (the command leaves it all to exit()).
+ * Each is set as it is made and cleared by whatever frees it first.
+ */
+struct {
+    struct options   *opt;      // cleanpath_main()'s
+    struct cleanpath *cp;       // cleanpath_main()'s or stream()'s
+    struct envjob    *jobs;     // --batch, calloc()ed so all can be freed
+    int     njobs;
+    cleanpath_stats  *stats;
+    char  **gargv;
+    char   *buf;                // stream()
+    int     fd;                 // stream(), 0 for stdin or none
+} held;
+
+#ifdef CP_BUILTIN
+/* From bash_cleanpath.c, the shell's own variables rather than environ */
+const char * cp_getvar( const char *name );
+int     cp_setvar( const char *name, const char *value );
+int     cleanpath_builtin_main( int argc, char *argv[] );
+#define CP_GETVAR(n)    cp_getvar(n)
+/* myexit() comes back here instead of ending the shell */
+jmp_buf cp_bail;
+int     cp_bailv;
+#else
+#define CP_GETVAR(n)    getenv(n)
+#endif
+
+int     cleanpath_main( int argc, char *argv[] );
+void    put_result( struct options *opt, const char *out );
+void    which( struct options *opt, struct cleanpath *cp );
+void    opt_ctx( struct options *opt, struct cleanpath *cp );
+const char * pull_env( struct options *opt );
+void    pull_sets( struct options *opt, struct cleanpath *cp );
+int     batch_mode( int argc, char *argv[] );
+void    batch( int argc, char *argv[], char **cmd );
+int     exec_split( int argc, char *argv[], char ***cmd );
+void    exec_cmd( char **cmd );
+void    print_export( const char *name, const char *value );
+unsigned long long now_ns();
+void    stats_add( const struct cleanpath_count *c );
+void    print_stats();
+void    trace_done();
+void    free_opt( struct options *opt );
+void    free_held();
+int     stream( struct options *opt );
+void    stream_extra( struct options *opt, struct cleanpath *cp );
 int     check_opt( struct options *opt, int argc, char *argv[] );
 void    help(char *me);
 void    usage(char *me);
@@ -47,192 +150,794 @@ void    set_file( struct options *opt, const char *arg, const int val );
 void    set_before( struct options *opt, const char *arg, const int val );
 void    set_noenv( struct options *opt, const char *arg, const int val );
 void    set_env( struct options *opt, const char *arg, const char *val );
-char *  elim_mult( char *str, int strlen, struct options *opt );
-bstr *  dedupe( struct options *opt, bstr *buffer );
+int     set_jobs( struct options *opt, const char *arg, const char *val );
+int     set_ttl( struct options *opt, const char *arg, const char *val );
+int     set_prune_max( struct options *opt, const char *arg, const char *val );
+int     add_set( struct options *opt, struct envset *set, const char *arg,
+                 const char *name );
 void    myexit(int status);
 
 #define S_I_ALL (S_IFMT|S_ISUID|S_ISGID|S_ISVTX|S_IRWXU|S_IRWXG|S_IRWXO)
 
+#ifdef CP_BUILTIN
+int
+cleanpath_builtin_main( int argc, char *argv[] )
+{
+    if ( setjmp( cp_bail ) ) {
+        return cp_bailv;
+    }
+    cleanpath_main( argc, argv );
+    return 0;
+}
+#else
 int
 main( int argc, char *argv[] )
 {
-    int memblk = 0;
-    bstr* holdenv;
-    char* origenv;
+    return cleanpath_main( argc, argv );
+}
+#endif
+
+/* Every way out is through myexit() */
+int
+cleanpath_main( int argc, char *argv[] )
+{
     struct options opts;
+    struct cleanpath cp;
+    char **cmd = NULL;
+    unsigned long long t0;
+
+    // A builtin runs this many times, the counts are per run
+    memset( &runstats, 0, sizeof(runstats) );
+    memset( &held, 0, sizeof(held) );
+    runstats.start = now_ns();
+    bstr_memstats( &runstats.total0, NULL, &runstats.count0 );
+    runstats.moved0 = bstr_moved();
+
+    // Anything after --exec is the command, not ours
+    argc = exec_split( argc, argv, &cmd );
+
+    if ( batch_mode( argc, argv ) ) {
+        batch( argc, argv, cmd );
+        myexit(0);
+    }
 
     // init opt structure with defaults
     default_opt( &opts );
+    held.opt = &opts;
     // Set options
+    t0 = now_ns();
     check_opt( &opts, argc, argv );
+    runstats.check_opt_ns += now_ns() - t0;
+    trace_span( "check_opt", t0, NULL, 0, 0 );
 
-    origenv = getenv(opts.env->s);
-    if ((origenv) && (*origenv)) {
-        memblk = strz_len(origenv);
+    if ( opts.input ) {
+        if ( cmd || opts.which || opts.unions.n ) {
+            fprintf( stderr, "--stdin and --input can not be used with"
+                " --exec, --which or --union\n" );
+            usage(argv[0]);
+            myexit(2);
+        }
+        stream( &opts );
+        myexit(0);
+    }
+    if ( cmd && ( ! *opts.env->s ) ) {
+        fprintf( stderr, "--exec needs an ENVNAME to set\n" );
+        usage(argv[0]);
+        myexit(2);
+    }
+    if ( cmd && opts.which ) {
+        fprintf( stderr, "--which prints instead of the result, it can not"
+            " be used with --exec\n" );
+        usage(argv[0]);
+        myexit(2);
     }
-    holdenv = new_bstr( memblk );
-    if ( holdenv == NULL ) { exit(5); }
 
-    if ( opts.debug ) {
-        if ( !origenv ) {
-            fprintf(stderr, "Pull ENVNAME, %s, is empty\n", opts.env->s);
-        } else {
-            fprintf(stderr, "Pull ENVNAME, %s, \"%s\"\n", opts.env->s, origenv);
-        }
+    // All of the work is in libcleanpath
+    cleanpath_init( &cp );
+    held.cp = &cp;
+    opt_ctx( &opts, &cp );
+    cp.input = pull_env( &opts );
+    pull_sets( &opts, &cp );
+    if ( cleanpath_run( &cp ) ) {
+        fprintf(stderr, "Fatal: cleanpath_run(): %s\n", strerror(errno) );
+        myexit(5);
     }
 
-    if ( opts.before ) {
-        // Concat any command-line extras into holdenv
-        bstr_cat(holdenv, opts.extra);
-        // Add a delimiter to holdenv
-        bstr_catstrz(holdenv, &opts.delimiter, 1);
-        // Cat requested ENV VAR onto holdenv
-        bstr_catstrz(holdenv, origenv, holdenv->a);
+    stats_add( &cp.count );
+
+    if ( opts.which ) {
+        which( &opts, &cp );
     }
-    else {
-        // Copy requested ENV VAR into holdenv
-        bstr_catstrz(holdenv, origenv, holdenv->a);
-        // Add a delimiter to holdenv
-        bstr_catstrz(holdenv, &opts.delimiter, 1);
-        // Concat any command-line extras into holdenv
-        bstr_cat(holdenv, opts.extra);
+    if ( cmd ) {
+        if ( setenv( opts.env->s, cp.out, 1 ) ) {
+            fprintf(stderr, "Fatal: setenv(): %s\n", strerror(errno) );
+            myexit(5);
+        }
+        if ( opts.stats ) {
+            print_stats();
+        }
+        exec_cmd( cmd );
+    }
+    t0 = now_ns();
+    put_result( &opts, cp.out );
+    runstats.output_ns += now_ns() - t0;
+    trace_span( "output", t0, NULL, 0, 0 );
+    cleanpath_free( &cp );
+    if ( opts.stats ) {
+        print_stats();
     }
-
     if ( opts.debug ) {
-        fprintf(stderr, "Concat ENV and ENVADD => \"%s\"\n", holdenv->s);
+        size_t total, peak, count;
+        bstr_memstats( &total, &peak, &count );
+        fprintf( stderr, "bstr: %zu allocations, %zu bytes, %zu bytes peak\n",
+            count, total, peak );
     }
+    myexit(0);
+    return 0;
+}
 
-    // Eliminate multiple :
-    elim_mult( holdenv->s, holdenv->a, &opts );
-    if ( opts.debug ) {
-        fprintf(stderr, "Remove redundant delimiters \"%s\"\n", holdenv->s);
+/* Print it, or as a bash builtin, assign it to ENVNAME */
+void
+put_result( struct options *opt, const char *out )
+{
+#ifdef CP_BUILTIN
+    if ( *opt->env->s ) {
+        if ( cp_setvar( opt->env->s, out ) ) {
+            myexit(1);
+        }
+        return;
     }
+#endif
+    printf( "%s\n", out );
+    return;
+}
 
-    tokenwalk( &opts, holdenv );
+/* --which NAME: where NAME is found in the result, instead of it */
+void
+which( struct options *opt, struct cleanpath *cp )
+{
+    char    buf[4096];
+    int     found;
+    unsigned long long t0;
 
-    while ( holdenv->s[ holdenv->l - 1 ] == opts.delimiter ) {
-        holdenv->s[ --holdenv->l ] = (char)0;
+    found = cleanpath_which( cp, opt->which, buf, sizeof(buf) );
+    if ( -1 == found ) {
+        fprintf(stderr, "Fatal: which(): %s\n", strerror(errno) );
+        myexit(5);
+    }
+    if ( found ) {
+        t0 = now_ns();
+        printf( "%s\n", buf );
+        runstats.output_ns += now_ns() - t0;
+    }
+    if ( opt->stats ) {
+        print_stats();
     }
+    myexit( found ? 0 : 1 );
+}
 
-    printf( "%s\n", BS(holdenv) );
-    myexit(0);
+/* The parts of options that libcleanpath needs */
+void
+opt_ctx( struct options *opt, struct cleanpath *cp )
+{
+    /* Each ENVADD went in after a delimiter, the first one is not
+     * redundant (--stats would count it) */
+    cp->extra     = opt->extra->s + ( opt->extra->l ? 1 : 0 );
+    cp->before    = opt->before;
+    cp->delimiter = opt->delimiter;
+    cp->checks    = ( opt->exist ? CLEANPATH_EXISTS : 0 )
+                  | ( opt->dir   ? CLEANPATH_DIRS   : 0 )
+                  | ( opt->file  ? CLEANPATH_FILES  : 0 )
+                  | ( opt->samefile ? CLEANPATH_SAMEFILE : 0 )
+                  | ( opt->prune ? CLEANPATH_PRUNE : 0 )
+                  | ( ( 2 == opt->prune ) ? CLEANPATH_REPORT : 0 )
+                  | ( opt->memo  ? CLEANPATH_MEMO  : 0 )
+                  | ( opt->normalize ? CLEANPATH_NORMALIZE : 0 )
+                  | ( ( 2 == opt->normalize ) ? CLEANPATH_NORMOUT : 0 );
+    cp->remove    = opt->remove.n ? opt->remove.name : NULL;
+    cp->prune_max = opt->prune_max;
+    cp->jobs      = opt->jobs;
+    cp->uring     = opt->uring;
+    cp->ttl       = opt->ttl;
+    cp->debug     = opt->debug;
+    return;
 }
 
-int
-dedupe_in( struct options *opt, bstr *whole, bstr *test, int start )
+/* Contents of ENVNAME, NULL if it is unset (or --noenv) */
+const char *
+pull_env( struct options *opt )
 {
-    int    inn_s = start;
-    int    inn_n = start;
-    bstr *itoken = new_bstr(whole->l);
+    const char* origenv = NULL;
+    unsigned long long t0 = now_ns();
 
-    while ( inn_n < bstr_len(whole) ) {
-        inn_n = bstr_index(opt->delimiter, whole, inn_s);
-        if ( ( 0 == inn_s ) && ( inn_n >= whole->l ) ) {
-            if ( opt->debug ) {
-                fprintf(stderr, "dedupe(): only one token");
-            }
-            break;
+    if ( *opt->env->s ) {
+        origenv = CP_GETVAR(opt->env->s);
+    }
+    runstats.env_ns += now_ns() - t0;
+    trace_span( "env", t0, opt->env->s, opt->env->l, 0 );
+    if ( opt->debug ) {
+        if ( !origenv ) {
+            fprintf(stderr, "Pull ENVNAME, %s, is empty\n", opt->env->s);
+        } else {
+            fprintf(stderr, "Pull ENVNAME, %s, \"%s\"\n", opt->env->s, origenv);
         }
-        bstr_copystrz( itoken, (whole->s + inn_s), inn_n - inn_s );
-#ifdef DEBUG
-        if ( 2 <= opt->debug ) {
-            fprintf( stderr, "DUP EVAL (%d) [%s] to [%s]\n",
-                inn_s, BS(itoken), BS(test));
+    }
+    return origenv;
+}
+
+/*
+ * --union, --minus and --intersect: read each ENVNAME (unset is empty),
+ * join the --union ones after cp->input, and hand libcleanpath the rest.
+ */
+void
+pull_sets( struct options *opt, struct cleanpath *cp )
+{
+    struct envset *sets[3];
+    int     sx;
+    int     vx;
+    unsigned long long t0 = now_ns();
+
+    sets[0] = &opt->unions;
+    sets[1] = &opt->minus;
+    sets[2] = &opt->isect;
+    for ( sx = 0; sx < 3; sx++ ) {
+        if ( !sets[sx]->n ) {
+            continue;
         }
-#endif
-        if ( !bstr_eq( itoken, test ) ) {
+        for ( vx = 0; vx < sets[sx]->n; vx++ ) {
+            const char *value = CP_GETVAR( sets[sx]->name[vx] );
+            sets[sx]->value[vx] = value ? value : "";
             if ( opt->debug ) {
-                fprintf( stderr, "duplicate token: [%s] (removing)\n",
-                    BS(itoken) );
+                fprintf( stderr, "Pull %s, %s, \"%s\"\n",
+                    ( 0 == sx ) ? "--union" : ( 1 == sx ) ? "--minus"
+                                : "--intersect",
+                    sets[sx]->name[vx], sets[sx]->value[vx] );
             }
-            bstr_splice( whole, inn_s, inn_n + 1, NULL );
-            if ( opt->debug ) {
-                fprintf( stderr, "duplicate token: [%s] removed leaving [%s]\n",
-                    BS(itoken), BS(whole) );
+        }
+        sets[sx]->value[vx] = NULL;
+    }
+    if ( opt->unions.n ) {
+        if ( !opt->joined ) {
+            opt->joined = new_bstr( 0 );
+            if ( !opt->joined ) {
+                myexit(5);
             }
-            inn_s = inn_n = start;
-            continue;
         }
-        inn_s = inn_n + 1;
+        bstr_copystrz( opt->joined, "", 1 );
+        if ( cp->input ) {
+            bstr_catstrz( opt->joined, cp->input, strz_len( cp->input ) + 1 );
+        }
+        for ( vx = 0; vx < opt->unions.n; vx++ ) {
+            bstr_catstrz( opt->joined, &opt->delimiter, 1 );
+            bstr_catstrz( opt->joined, opt->unions.value[vx],
+                strz_len( opt->unions.value[vx] ) + 1 );
+        }
+        cp->input = opt->joined->s;
+    }
+    cp->minus     = opt->minus.n ? opt->minus.value : NULL;
+    cp->intersect = opt->isect.n ? opt->isect.value : NULL;
+    runstats.env_ns += now_ns() - t0;
+    trace_span( "sets", t0, NULL, 0,
+        opt->unions.n + opt->minus.n + opt->isect.n );
+    return;
+}
+
+/*
+ * --stdin / --input FILE: read the list STREAM_CHUNK bytes at a time
+ * through cleanpath_feed(), writing each new token as soon as its
+ * chunk has been checked.
+ */
+#define STREAM_CHUNK 65536
+
+/* Feed ENVADD into the stream, its output is left in cp->out */
+void
+stream_extra( struct options *opt, struct cleanpath *cp )
+{
+    if ( ( opt->extra->l )
+        && ( 0 > cleanpath_feed( cp, opt->extra->s + 1,
+                                 opt->extra->l - 1, 1 ) ) )
+    {
+        fprintf(stderr, "Fatal: stream(): %s\n", strerror(errno) );
+        myexit(5);
     }
-    return(whole->l);
+    return;
 }
 
 int
-token_check( struct options *opt, bstr *token )
-{
-    int modefail = 0;
-    struct stat statbuf;
-    int statret;
-    if ( opt->exist || opt->file || opt->dir ) {
-        statret = stat( BS(token), &statbuf );
-        if ( -1 == statret ) {
-            if ( opt->debug ) {
-                fprintf( stderr, "token_check(): Not exists: \"%s\"\n",
-                    BS(token) );
+stream( struct options *opt )
+{
+    struct cleanpath cp;
+    char   *buf;
+    size_t  a    = STREAM_CHUNK;
+    size_t  have = 0;
+    int     eof  = 0;
+    int     fd   = 0;
+    unsigned long long t0;
+
+    if ( strcmp( "-", opt->input ) ) {
+        fd = open( opt->input, O_RDONLY );
+        if ( 0 > fd ) {
+            fprintf( stderr, "Can not read '%s': %s\n",
+                opt->input, strerror(errno) );
+            myexit(2);
+        }
+        held.fd = fd;
+    }
+    buf = malloc( a );
+    if ( !buf ) {
+        fprintf(stderr, "Fatal: stream(): %s\n", strerror(errno) );
+        myexit(5);
+    }
+    held.buf = buf;
+    cleanpath_init( &cp );
+    held.cp = &cp;
+    opt_ctx( opt, &cp );
+    pull_sets( opt, &cp );
+
+    if ( opt->debug ) {
+        fprintf( stderr, "stream(): reading %s, ENVNAME is not used\n",
+            strcmp( "-", opt->input ) ? opt->input : "stdin" );
+    }
+    /* ENVADD goes where it would with ENVNAME, ahead with --before */
+    if ( opt->before ) {
+        stream_extra( opt, &cp );
+    }
+    while ( !eof ) {
+        ssize_t got;
+        long    used;
+        if ( have == a ) {
+            /* One token longer than the buffer */
+            char *grow = realloc( buf, 2 * a );
+            if ( !grow ) {
+                fprintf(stderr, "Fatal: stream(): %s\n", strerror(errno) );
+                myexit(5);
+            }
+            buf = grow;
+            held.buf = buf;
+            a *= 2;
+        }
+        got = read( fd, buf + have, a - have );
+        if ( 0 > got ) {
+            if ( EINTR == errno ) {
+                continue;
             }
-            modefail = 7;
+            fprintf( stderr, "Can not read '%s': %s\n",
+                opt->input, strerror(errno) );
+            myexit(2);
         }
-        /* file and dir checks below here, everything else, add above */
-        else if ( opt->file && opt->dir ) {
-            /* If BOTH are set, BOTH of these have to fail */
-            if (   ( S_IFDIR != ( statbuf.st_mode & S_IFMT ) )
-                && ( S_IFREG != ( statbuf.st_mode & S_IFMT ) ) )
+        if ( 0 == got ) {
+            eof = 1;
+        }
+        have += got;
+        used = cleanpath_feed( &cp, buf, have, eof );
+        if ( 0 > used ) {
+            fprintf(stderr, "Fatal: stream(): %s\n", strerror(errno) );
+            myexit(5);
+        }
+        memmove( buf, buf + used, have - used );
+        have -= used;
+        t0 = now_ns();
+        fwrite( cp.out, 1, cp.outlen, stdout );
+        runstats.output_ns += now_ns() - t0;
+        trace_span( "output", t0, NULL, 0, 0 );
+        cp.outlen = 0;
+    }
+    if ( !opt->before ) {
+        stream_extra( opt, &cp );
+        t0 = now_ns();
+        fwrite( cp.out, 1, cp.outlen, stdout );
+        runstats.output_ns += now_ns() - t0;
+        cp.outlen = 0;
+    }
+    putchar( '\n' );
+
+    if ( fd ) {
+        close( fd );
+    }
+    free( buf );
+    stats_add( &cp.count );
+    cleanpath_free( &cp );
+    held.fd  = 0;
+    held.buf = NULL;
+    held.cp  = NULL;
+    if ( opt->stats ) {
+        print_stats();
+    }
+    return 0;
+}
+
+/*
+ * --batch: argv is split into groups at each --next, each group is a
+ * whole cleanpath command line of its own (ENVNAME, ENVADD, checks,
+ * delimiter, --before).  --jobs, --uring and --cache-ttl come from the
+ * first group.  Returns 1 if --batch comes before the first -- or --next.
+ */
+int
+batch_mode( int argc, char *argv[] )
+{
+    int argcx;
+    for ( argcx = 1; argcx < argc; argcx++ ) {
+        if ( ( 0 == strcmp( "--", argv[argcx] ) )
+            || ( 0 == strcmp( "--next", argv[argcx] ) )
+            || ( 0 == strcmp( "--exec", argv[argcx] ) ) )
+        {
+            return 0;
+        }
+        if ( 0 == strcmp( "--batch", argv[argcx] ) ) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Each group's tokens are queued in one cleanpath_stats, so a directory
+ * named by several ENVNAMEs is only looked up once.  When an ENVNAME comes
+ * up again, everything before it is finished (and setenv()) first,
+ * which gives the same result as running each group on its own.
+ */
+void
+batch( int argc, char *argv[], char **cmd )
+{
+    struct envjob *jobs;
+    cleanpath_stats *stats;
+    char  **gargv;
+    int     ngroup = 1;
+    int     argcx;
+    int     gx;
+    int     first = 0;
+    unsigned long long t0;
+
+    for ( argcx = 1; argcx < argc; argcx++ ) {
+        if ( 0 == strcmp( "--next", argv[argcx] ) ) {
+            ngroup++;
+        }
+    }
+    jobs  = calloc( ngroup, sizeof(struct envjob) );
+    gargv = malloc( ( argc + 1 ) * sizeof(char *) );
+    held.jobs  = jobs;
+    held.njobs = ngroup;
+    held.gargv = gargv;
+    if ( ( !jobs ) || ( !gargv ) ) {
+        fprintf(stderr, "Fatal: batch(): %s\n", strerror(errno) );
+        myexit(5);
+    }
+
+    gargv[0] = argv[0];
+    argcx = 1;
+    for ( gx = 0; gx < ngroup; gx++ ) {
+        int gargc = 1;
+        for ( ; ( argcx < argc )
+                && ( strcmp( "--next", argv[argcx] ) ); argcx++ )
+        {
+            gargv[gargc++] = argv[argcx];
+        }
+        argcx++;
+        gargv[gargc] = NULL;
+
+        default_opt( &jobs[gx].opt );
+        t0 = now_ns();
+        check_opt( &jobs[gx].opt, gargc, gargv );
+        runstats.check_opt_ns += now_ns() - t0;
+        trace_span( "check_opt", t0, NULL, 0, 0 );
+        if ( jobs[gx].opt.input || jobs[gx].opt.which ) {
+            fprintf( stderr, "--stdin, --input and --which can not be used"
+                " with --batch\n" );
+            usage(argv[0]);
+            myexit(2);
+        }
+        if ( gx ) {
+            jobs[gx].opt.jobs  = jobs[0].opt.jobs;
+            jobs[gx].opt.uring = jobs[0].opt.uring;
+            jobs[gx].opt.ttl   = jobs[0].opt.ttl;
+            jobs[gx].opt.stats = jobs[0].opt.stats;
+        }
+
+        const char *cx = jobs[gx].opt.env->s;
+        if ( ( !*cx ) || ( ( '_' != *cx )
+            && ( ( *cx < 'A' ) || ( *cx > 'Z' ) )
+            && ( ( *cx < 'a' ) || ( *cx > 'z' ) ) ) )
+        {
+            cx = NULL;
+        }
+        for ( ; cx && *cx; cx++ ) {
+            if ( ( '_' != *cx )
+                && ( ( *cx < 'A' ) || ( *cx > 'Z' ) )
+                && ( ( *cx < 'a' ) || ( *cx > 'z' ) )
+                && ( ( *cx < '0' ) || ( *cx > '9' ) ) )
             {
-                if ( opt->debug ) {
-                    fprintf( stderr, "token_check(): Not a regular file or dir: \"%s\"\n",
-                        BS(token) );
+                cx = NULL;
+                break;
+            }
+        }
+        if ( !cx ) {
+            fprintf( stderr, "--batch group %d needs an ENVNAME to export"
+                " (got '%s')\n", gx + 1, jobs[gx].opt.env->s );
+            usage(argv[0]);
+            myexit(2);
+        }
+    }
+    free( gargv );
+    held.gargv = NULL;
+
+    stats = cleanpath_stats_new();
+    held.stats = stats;
+    if ( !stats ) {
+        fprintf(stderr, "Fatal: batch(): %s\n", strerror(errno) );
+        myexit(5);
+    }
+    for ( gx = 0; gx <= ngroup; gx++ ) {
+        int jx;
+        int again = ( gx == ngroup );
+        for ( jx = first; ( !again ) && ( jx < gx ); jx++ ) {
+            again = ( 0 == strcmp( jobs[jx].opt.env->s,
+                                   jobs[gx].opt.env->s ) );
+        }
+        if ( again ) {
+            /* Finish everything queued so far, the first finish does
+             * the lookups for all of them */
+            for ( jx = first; jx < gx; jx++ ) {
+                struct envjob *job = &jobs[jx];
+                if ( cleanpath_finish( &job->cp ) ) {
+                    fprintf(stderr, "Fatal: batch(): %s\n", strerror(errno) );
+                    myexit(5);
+                }
+#ifdef CP_BUILTIN
+                if ( cp_setvar( job->opt.env->s, job->cp.out ) ) {
+                    myexit(1);
+                }
+#else
+                if ( setenv( job->opt.env->s, job->cp.out, 1 ) ) {
+                    fprintf(stderr, "Fatal: batch(): %s\n", strerror(errno) );
+                    myexit(5);
                 }
-                modefail = 3;
+                if ( !cmd ) {
+                    t0 = now_ns();
+                    print_export( job->opt.env->s, job->cp.out );
+                    runstats.output_ns += now_ns() - t0;
+                    trace_span( "output", t0, NULL, 0, 0 );
+                }
+#endif
+                stats_add( &job->cp.count );
+                cleanpath_free( &job->cp );
             }
+            first = gx;
         }
-        else if ( ( opt->file )
-            && ( S_IFREG != ( statbuf.st_mode & S_IFMT ) ) )
-        {
-            if ( opt->debug ) {
-                fprintf( stderr, "token_check(): Not a regular file: \"%s\"\n", BS(token) );
+        if ( gx < ngroup ) {
+            struct envjob *job = &jobs[gx];
+            cleanpath_init( &job->cp );
+            opt_ctx( &job->opt, &job->cp );
+            job->cp.input = pull_env( &job->opt );
+            pull_sets( &job->opt, &job->cp );
+            job->cp.stats = stats;
+            if ( cleanpath_queue( &job->cp ) ) {
+                fprintf(stderr, "Fatal: batch(): %s\n", strerror(errno) );
+                myexit(5);
             }
-            modefail = 2;
         }
-        else if ( ( opt->dir )
-            && ( S_IFDIR != ( statbuf.st_mode & S_IFMT ) ) )
-        {
-            if ( opt->debug ) {
-                fprintf( stderr, "token_check(): Not a directory: \"%s\"\n", BS(token) );
+    }
+    cleanpath_stats_free( stats );
+    held.stats = NULL;
+    if ( jobs[0].opt.stats ) {
+        print_stats();
+    }
+    for ( gx = 0; gx < ngroup; gx++ ) {
+        free_opt( &jobs[gx].opt );
+    }
+    free( jobs );
+    held.jobs = NULL;
+    if ( cmd ) {
+        exec_cmd( cmd );
+    }
+    return;
+}
+
+/*
+ * --exec: argv is cut at the first --exec (even past --), the rest is
+ * the command to run with the cleaned variables.  Returns the argc that
+ * is left for cleanpath itself.
+ */
+int
+exec_split( int argc, char *argv[], char ***cmd )
+{
+    int argcx;
+    *cmd = NULL;
+    for ( argcx = 1; argcx < argc; argcx++ ) {
+        if ( 0 == strcmp( "--exec", argv[argcx] ) ) {
+#ifdef CP_BUILTIN
+            fprintf( stderr, "--exec would replace the shell, use the"
+                " cleanpath command for that\n" );
+            myexit(2);
+#endif
+            if ( argcx + 1 >= argc ) {
+                fprintf( stderr, "--exec needs a command\n" );
+                usage(argv[0]);
+                myexit(2);
             }
-            modefail = 1;
+            *cmd = &argv[argcx + 1];
+            return argcx;
         }
     }
-    return (modefail);
+    return argc;
 }
 
-bstr *
-tokenwalk( struct options *opt, bstr *whole )
+/* Replace this process with cmd, with the environment as it now is */
+void
+exec_cmd( char **cmd )
 {
-    bstr *otoken = new_bstr(whole->l);
-    int    out_s = 0;
-    int    out_n = 0;
-    while ( out_n < bstr_len(whole) ) {
-        out_n = bstr_index(opt->delimiter, whole, out_s);
-        bstr_copystrz( otoken, (whole->s + out_s), out_n - out_s );
-        if ( opt->debug ) {
-            fprintf( stderr, "EVALUATE (%d) [%s] of [%s]\n",
-                out_s, BS(otoken), BS(whole) );
+    int     err;
+
+    fflush( stdout );
+    trace_done();
+    execvp( cmd[0], cmd );
+    /* Before anything else can change it */
+    err = errno;
+    /* Same codes as a shell would give */
+    fprintf( stderr, "cleanpath: %s: %s\n", cmd[0], strerror(err) );
+    myexit( ( ENOENT == err ) ? 127 : 126 );
+}
+
+/* NAME='value'; export NAME -- safe for eval in any Bourne shell */
+void
+print_export( const char *name, const char *value )
+{
+    const char *cx;
+
+    printf( "%s='", name );
+    for ( cx = value; *cx; cx++ ) {
+        if ( '\'' == *cx ) {
+            fputs( "'\\''", stdout );
         }
-        dedupe_in( opt, whole, otoken, out_n + 1 );
-        if ( token_check( opt, otoken ) ) {
-            bstr_splice( whole, out_s, out_n + 1, NULL );
-            if ( opt->debug ) {
-                fprintf( stderr, "tokenwalk(): Removed (%d)[%s] from [%s]\n",
-                    out_s, BS(otoken), BS(whole) );
-            }
-            /* Chopped out current token, continue with new current token */
-            out_n = out_s;
-            continue;
+        else {
+            putchar( *cx );
         }
-        out_s = out_n + 1;
     }
-    return whole;
+    printf( "'; export %s\n", name );
+    return;
+}
+
+unsigned long long
+now_ns()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ( (unsigned long long)ts.tv_sec * 1000000000ULL ) + ts.tv_nsec;
+}
+
+/* Sum one context's counts into runstats */
+void
+stats_add( const struct cleanpath_count *c )
+{
+    struct cleanpath_count *sum = &runstats.lib;
+    sum->concat_ns  += c->concat_ns;
+    sum->split_ns   += c->split_ns;
+    sum->dedupe_ns  += c->dedupe_ns;
+    sum->stat_ns    += c->stat_ns;
+    sum->check_ns   += c->check_ns;
+    sum->tokens_in  += c->tokens_in;
+    sum->empty      += c->empty;
+    sum->dupes      += c->dupes;
+    sum->tokens_out += c->tokens_out;
+    sum->lookups    += c->lookups;
+    sum->stat_calls += c->stat_calls;
+    sum->stat_fail  += c->stat_fail;
+    sum->check_fail += c->check_fail;
+    sum->samefile   += c->samefile;
+    sum->pruned     += c->pruned;
+    sum->dirents    += c->dirents;
+    sum->memo       += c->memo;
+    sum->filtered   += c->filtered;
+    sum->removed    += c->removed;
+    sum->normalized += c->normalized;
+    return;
+}
+
+/*
+ * --stats: one "stats: NAME VALUE" line each, to stderr, after the
+ * output.  Times are in ns.  Cheap enough to leave on, unlike --debug.
+ */
+void
+print_stats()
+{
+    struct cleanpath_count *c = &runstats.lib;
+    size_t total, peak, count;
+
+    bstr_memstats( &total, &peak, &count );
+    fflush( stdout );
+    fprintf( stderr, "stats: check_opt_ns %llu\n", runstats.check_opt_ns );
+    fprintf( stderr, "stats: env_ns %llu\n",       runstats.env_ns );
+    fprintf( stderr, "stats: concat_ns %llu\n",    c->concat_ns );
+    fprintf( stderr, "stats: split_ns %llu\n",     c->split_ns );
+    fprintf( stderr, "stats: dedupe_ns %llu\n",    c->dedupe_ns );
+    fprintf( stderr, "stats: stat_ns %llu\n",      c->stat_ns );
+    fprintf( stderr, "stats: check_ns %llu\n",     c->check_ns );
+    fprintf( stderr, "stats: output_ns %llu\n",    runstats.output_ns );
+    fprintf( stderr, "stats: total_ns %llu\n",     now_ns() - runstats.start );
+    fprintf( stderr, "stats: tokens_in %ld\n",     c->tokens_in );
+    fprintf( stderr, "stats: empty %ld\n",         c->empty );
+    fprintf( stderr, "stats: dupes %ld\n",         c->dupes );
+    fprintf( stderr, "stats: normalized %ld\n",    c->normalized );
+    fprintf( stderr, "stats: filtered %ld\n",      c->filtered );
+    fprintf( stderr, "stats: removed %ld\n",       c->removed );
+    fprintf( stderr, "stats: check_fail %ld\n",    c->check_fail );
+    fprintf( stderr, "stats: samefile %ld\n",      c->samefile );
+    fprintf( stderr, "stats: pruned %ld\n",        c->pruned );
+    fprintf( stderr, "stats: dirents %ld\n",       c->dirents );
+    fprintf( stderr, "stats: memo %ld\n",          c->memo );
+    fprintf( stderr, "stats: tokens_out %ld\n",    c->tokens_out );
+    fprintf( stderr, "stats: lookups %ld\n",       c->lookups );
+    fprintf( stderr, "stats: stat_calls %ld\n",    c->stat_calls );
+    fprintf( stderr, "stats: stat_fail %ld\n",     c->stat_fail );
+    fprintf( stderr, "stats: bstr_allocs %zu\n",   count - runstats.count0 );
+    fprintf( stderr, "stats: bstr_bytes %zu\n",    total - runstats.total0 );
+    fprintf( stderr, "stats: bstr_peak %zu\n",     peak );
+    fprintf( stderr, "stats: splice_moved %zu\n",  bstr_moved() - runstats.moved0 );
+    return;
+}
+
+/* --trace: the whole run as one span, then the ring out to FILE */
+void
+trace_done()
+{
+    if ( ( !runstats.trace ) || ( !trace_on() ) ) {
+        return;
+    }
+    trace_span( "cleanpath", runstats.start, NULL, 0, 0 );
+    if ( trace_write( runstats.trace ) ) {
+        fprintf( stderr, "Can not write trace '%s': %s\n",
+            runstats.trace, strerror(errno) );
+    }
+    trace_close();
+    runstats.trace = NULL;
+    return;
+}
+
+/* The --union, --minus, --intersect and --remove arrays (the bstrs go
+ * with free_ALL_bstr()) */
+void
+free_opt( struct options *opt )
+{
+    struct envset *sets[4];
+    int     sx;
+
+    sets[0] = &opt->unions;
+    sets[1] = &opt->minus;
+    sets[2] = &opt->isect;
+    sets[3] = &opt->remove;
+    for ( sx = 0; sx < 4; sx++ ) {
+        free( sets[sx]->name );
+        free( sets[sx]->value );
+        memset( sets[sx], 0, sizeof(struct envset) );
+    }
+    return;
+}
+
+/* Whatever this run still holds, see held */
+void
+free_held()
+{
+    int     jx;
+
+    if ( held.fd ) {
+        close( held.fd );
+    }
+    free( held.buf );
+    free( held.gargv );
+    if ( held.cp ) {
+        cleanpath_free( held.cp );
+    }
+    if ( held.opt ) {
+        free_opt( held.opt );
+    }
+    /* Queued jobs point into stats, so they go first */
+    for ( jx = 0; ( held.jobs ) && ( jx < held.njobs ); jx++ ) {
+        cleanpath_free( &held.jobs[jx].cp );
+        free_opt( &held.jobs[jx].opt );
+    }
+    free( held.jobs );
+    cleanpath_stats_free( held.stats );
+    memset( &held, 0, sizeof(held) );
+    return;
 }
 
 int
@@ -244,6 +949,19 @@ check_opt( struct options *opt, int argc, char *argv[] )
     int askversion = 0;
     int haveenv    = 0;
     int argFEatsArg = 0;
+    int nocache    = 0;
+    char *envttl   = getenv("CLEANPATH_CACHE_TTL");
+    char *envmemo  = getenv("CLEANPATH_MEMO");
+
+    /* A profile can turn the cache on once, for every cleanpath */
+    if ( ( envttl ) && ( *envttl ) ) {
+        if ( !set_ttl( opt, "CLEANPATH_CACHE_TTL", envttl ) ) {
+            opt->ttl = 0;
+        }
+    }
+    if ( ( envmemo ) && ( *envmemo ) && ( strcmp( envmemo, "0" ) ) ) {
+        opt->memo = 1;
+    }
 
     // Read command line options...
     for ( argcx = 1; argcx < argc; argcx++ ) {
@@ -254,45 +972,238 @@ check_opt( struct options *opt, int argc, char *argv[] )
             if ( 2 <= opt->debug ) {
                 fprintf( stderr, "CMDLINE %d [%s]\n", argcx, argv[argcx] );
             }
-#endif
-            if ( strneqstrn( "--before", strlen("--before"),
+#endif
+            if ( strneqstrn( "--before", strlen("--before"),
+                argv[argcx], strlen(argv[argcx]) ) )
+            {
+                set_before( opt, argv[argcx], 1 );
+            }
+            else if ( strneqstrn( "--exists", strlen("--exists"),
+                        argv[argcx], strlen(argv[argcx]) ) )
+            {
+                set_exist( opt, argv[argcx], 1 );
+            }
+            else if ( strneqstrn( "--checkpaths", strlen("--checkpaths"),
+                        argv[argcx], strlen(argv[argcx]) ) )
+            {
+                set_dir( opt, argv[argcx], 1 );
+            }
+            else if ( strneqstrn( "--checkfiles", strlen("--checkfiles"),
+                        argv[argcx], strlen(argv[argcx]) ) )
+            {
+                set_file( opt, argv[argcx], 1 );
+            }
+            else if ( strneqstrn( "--samefile", strlen("--samefile"),
+                        argv[argcx], strlen(argv[argcx]) ) )
+            {
+                opt->samefile = 1;
+            }
+            else if ( strneqstrn( "--normalize", strlen("--normalize"),
+                        argv[argcx], strlen(argv[argcx]) ) )
+            {
+                opt->normalize = 1;
+            }
+            else if ( strneqstrn( "--normalize-output",
+                        strlen("--normalize-output"),
+                        argv[argcx], strlen(argv[argcx]) ) )
+            {
+                opt->normalize = 2;
+            }
+            else if ( strneqstrn( "--prune", strlen("--prune"),
+                        argv[argcx], strlen(argv[argcx]) ) )
+            {
+                set_dir( opt, argv[argcx], 1 );
+                if ( !opt->prune ) {
+                    opt->prune = 1;
+                }
+            }
+            else if ( strneqstrn( "--prune-report", strlen("--prune-report"),
+                        argv[argcx], strlen(argv[argcx]) ) )
+            {
+                set_dir( opt, argv[argcx], 1 );
+                opt->prune = 2;
+            }
+            else if ( strneqstrn( "--prune-limit", strlen("--prune-limit"),
+                argv[argcx], strlen(argv[argcx]) ) )
+            {
+                if ( ( argcx + 1 < argc )
+                    && ( set_prune_max( opt, argv[argcx], argv[argcx+1] ) ) )
+                {
+                    argcx++;
+                }
+                else {
+                    usage(argv[0]);
+                    myexit(2);
+                }
+            }
+            else if ( strneqstrn( "--noenv", strlen("--noenv"),
+                argv[argcx], strlen(argv[argcx]) ) )
+            {
+                set_noenv( opt, argv[argcx], 1 );
+                haveenv = 1;
+            }
+            else if ( strneqstrn( "--env", strlen("--env"),
+                argv[argcx], strlen(argv[argcx]) ) )
+            {
+                if ( argcx + 1 < argc ) {
+                    set_env( opt, argv[argcx], argv[argcx+1] );
+                    argcx++;
+                }
+                else {
+                    usage(argv[0]);
+                    myexit(2);
+                }
+                haveenv = 1;
+            }
+            else if ( strneqstrn( "--jobs", strlen("--jobs"),
+                argv[argcx], strlen(argv[argcx]) ) )
+            {
+                if ( ( argcx + 1 < argc )
+                    && ( set_jobs( opt, argv[argcx], argv[argcx+1] ) ) )
+                {
+                    argcx++;
+                }
+                else {
+                    usage(argv[0]);
+                    myexit(2);
+                }
+            }
+            else if ( strneqstrn( "--stdin", strlen("--stdin"),
+                argv[argcx], strlen(argv[argcx]) ) )
+            {
+                opt->input = "-";
+            }
+            else if ( strneqstrn( "--input", strlen("--input"),
                 argv[argcx], strlen(argv[argcx]) ) )
             {
-                set_before( opt, argv[argcx], 1 );
+                if ( argcx + 1 < argc ) {
+                    opt->input = argv[argcx+1];
+                    argcx++;
+                }
+                else {
+                    usage(argv[0]);
+                    myexit(2);
+                }
             }
-            else if ( strneqstrn( "--exists", strlen("--exists"),
+            else if ( strneqstrn( "--batch", strlen("--batch"),
+                argv[argcx], strlen(argv[argcx]) ) )
+            {
+                /* batch_mode() has already seen it */
+            }
+            else if ( strneqstrn( "--uring", strlen("--uring"),
+                argv[argcx], strlen(argv[argcx]) ) )
+            {
+                opt->uring = 1;
+            }
+            else if ( strneqstrn( "--stats", strlen("--stats"),
+                argv[argcx], strlen(argv[argcx]) ) )
+            {
+                opt->stats = 1;
+            }
+            else if ( strneqstrn( "--trace", strlen("--trace"),
+                argv[argcx], strlen(argv[argcx]) ) )
+            {
+                if ( argcx + 1 < argc ) {
+                    opt->trace = argv[argcx+1];
+                    argcx++;
+                }
+                else {
+                    usage(argv[0]);
+                    myexit(2);
+                }
+            }
+            else if ( strneqstrn( "--which", strlen("--which"),
+                argv[argcx], strlen(argv[argcx]) ) )
+            {
+                if ( argcx + 1 < argc ) {
+                    opt->which = argv[argcx+1];
+                    argcx++;
+                }
+                else {
+                    usage(argv[0]);
+                    myexit(2);
+                }
+            }
+            else if ( strneqstrn( "--union", strlen("--union"),
                         argv[argcx], strlen(argv[argcx]) ) )
             {
-                set_exist( opt, argv[argcx], 1 );
+                if ( ( argcx + 1 < argc )
+                    && ( add_set( opt, &opt->unions, argv[argcx],
+                                  argv[argcx+1] ) ) )
+                {
+                    argcx++;
+                }
+                else {
+                    usage(argv[0]);
+                    myexit(2);
+                }
             }
-            else if ( strneqstrn( "--checkpaths", strlen("--checkpaths"),
+            else if ( strneqstrn( "--minus", strlen("--minus"),
                         argv[argcx], strlen(argv[argcx]) ) )
             {
-                set_dir( opt, argv[argcx], 1 );
+                if ( ( argcx + 1 < argc )
+                    && ( add_set( opt, &opt->minus, argv[argcx],
+                                  argv[argcx+1] ) ) )
+                {
+                    argcx++;
+                }
+                else {
+                    usage(argv[0]);
+                    myexit(2);
+                }
             }
-            else if ( strneqstrn( "--checkfiles", strlen("--checkfiles"),
+            else if ( strneqstrn( "--intersect", strlen("--intersect"),
                         argv[argcx], strlen(argv[argcx]) ) )
             {
-                set_file( opt, argv[argcx], 1 );
+                if ( ( argcx + 1 < argc )
+                    && ( add_set( opt, &opt->isect, argv[argcx],
+                                  argv[argcx+1] ) ) )
+                {
+                    argcx++;
+                }
+                else {
+                    usage(argv[0]);
+                    myexit(2);
+                }
             }
-            else if ( strneqstrn( "--noenv", strlen("--noenv"),
-                argv[argcx], strlen(argv[argcx]) ) )
+            else if ( strneqstrn( "--remove", strlen("--remove"),
+                        argv[argcx], strlen(argv[argcx]) ) )
             {
-                set_noenv( opt, argv[argcx], 1 );
-                haveenv = 1;
+                if ( ( argcx + 1 < argc )
+                    && ( add_set( opt, &opt->remove, argv[argcx],
+                                  argv[argcx+1] ) ) )
+                {
+                    argcx++;
+                }
+                else {
+                    usage(argv[0]);
+                    myexit(2);
+                }
             }
-            else if ( strneqstrn( "--env", strlen("--env"),
+            else if ( strneqstrn( "--cache-ttl", strlen("--cache-ttl"),
                 argv[argcx], strlen(argv[argcx]) ) )
             {
-                if ( argcx + 1 < argc ) {
-                    set_env( opt, argv[argcx], argv[argcx+1] );
+                if ( ( argcx + 1 < argc )
+                    && ( set_ttl( opt, argv[argcx], argv[argcx+1] ) ) )
+                {
                     argcx++;
                 }
                 else {
                     usage(argv[0]);
                     myexit(2);
                 }
-                haveenv = 1;
+                nocache = 0;
+            }
+            else if ( strneqstrn( "--no-cache", strlen("--no-cache"),
+                argv[argcx], strlen(argv[argcx]) ) )
+            {
+                nocache = 1;
+            }
+            else if ( strneqstrn( "--memo", strlen("--memo"),
+                argv[argcx], strlen(argv[argcx]) ) )
+            {
+                opt->memo = 1;
+                nocache = 0;
             }
 #ifndef NO_ARG_MAX
             else if ( strneqstrn( "--nosizelimit", strlen("--nosizelimit"),
@@ -491,6 +1402,47 @@ check_opt( struct options *opt, int argc, char *argv[] )
             {
                 argcx++;
             }
+            else if ( strneqstrn( "--jobs", strlen("--jobs"),
+                argv[argcx], strlen(argv[argcx]) ) )
+            {
+                argcx++;
+            }
+            else if ( strneqstrn( "--cache-ttl", strlen("--cache-ttl"),
+                argv[argcx], strlen(argv[argcx]) ) )
+            {
+                argcx++;
+            }
+            else if ( strneqstrn( "--prune-limit", strlen("--prune-limit"),
+                argv[argcx], strlen(argv[argcx]) ) )
+            {
+                argcx++;
+            }
+            else if ( strneqstrn( "--input", strlen("--input"),
+                argv[argcx], strlen(argv[argcx]) ) )
+            {
+                argcx++;
+            }
+            else if ( strneqstrn( "--trace", strlen("--trace"),
+                argv[argcx], strlen(argv[argcx]) ) )
+            {
+                argcx++;
+            }
+            else if ( strneqstrn( "--which", strlen("--which"),
+                argv[argcx], strlen(argv[argcx]) ) )
+            {
+                argcx++;
+            }
+            else if ( ( strneqstrn( "--union", strlen("--union"),
+                            argv[argcx], strlen(argv[argcx]) ) )
+                || ( strneqstrn( "--minus", strlen("--minus"),
+                            argv[argcx], strlen(argv[argcx]) ) )
+                || ( strneqstrn( "--intersect", strlen("--intersect"),
+                            argv[argcx], strlen(argv[argcx]) ) )
+                || ( strneqstrn( "--remove", strlen("--remove"),
+                            argv[argcx], strlen(argv[argcx]) ) ) )
+            {
+                argcx++;
+            }
             else if ( strneqstrn( "--delimiter", strlen("--delimiter"),
                 argv[argcx], strlen(argv[argcx]) ) )
             {
@@ -540,7 +1492,21 @@ check_opt( struct options *opt, int argc, char *argv[] )
         }
     }
 
-    if ( opt->before && ( ! *opt->env->s ) ) {
+    if ( nocache ) {
+        opt->ttl  = 0;
+        opt->memo = 0;
+    }
+
+    /* In a --batch, the first --trace seen is the one */
+    if ( ( opt->trace ) && ( !runstats.trace ) ) {
+        if ( trace_open( TRACE_EVENTS ) ) {
+            fprintf(stderr, "Fatal: check_opt(): %s\n", strerror(errno) );
+            myexit(5);
+        }
+        runstats.trace = opt->trace;
+    }
+
+    if ( opt->before && ( ! *opt->env->s ) && ( !opt->input ) ) {
         fprintf( stderr, "%s\n", "WARN: --before meaningless with --noenv" );
     }
 
@@ -549,14 +1515,34 @@ check_opt( struct options *opt, int argc, char *argv[] )
             (opt->exist|opt->file|opt->dir) );
         fprintf( stderr, " --checkpaths: %d\n", opt->dir );
         fprintf( stderr, " --checkfiles: %d\n", opt->file );
+        fprintf( stderr, "   --samefile: %d\n", opt->samefile );
+        fprintf( stderr, "  --normalize: %d\n", opt->normalize );
+        fprintf( stderr, "      --prune: %d\n", opt->prune );
+        fprintf( stderr, "--prune-limit: %d\n", opt->prune_max );
         fprintf( stderr, "  --delimiter:'%c'\n", opt->delimiter );
         fprintf( stderr, "     --before: %d\n", opt->before );
+        fprintf( stderr, "       --jobs: %d\n", opt->jobs );
+        fprintf( stderr, "      --uring: %d\n", opt->uring );
+        fprintf( stderr, "  --cache-ttl: %d\n", opt->ttl );
+        fprintf( stderr, "       --memo: %d\n", opt->memo );
+        fprintf( stderr, "      --stats: %d\n", opt->stats );
+        fprintf( stderr, "      --trace: %s\n",
+                opt->trace?opt->trace:"\t(none)" );
+        fprintf( stderr, "      --which: %s\n",
+                opt->which?opt->which:"\t(none)" );
+        fprintf( stderr, "      --union: %d\n", opt->unions.n );
+        fprintf( stderr, "      --minus: %d\n", opt->minus.n );
+        fprintf( stderr, "  --intersect: %d\n", opt->isect.n );
+        fprintf( stderr, "     --remove: %d\n", opt->remove.n );
+        fprintf( stderr, "      --input: %s\n",
+                opt->input?opt->input:"\t(none)" );
 #ifndef NO_ARG_MAX
         fprintf( stderr, "--nosizelimit: %d\n", !opt->sizewarn );
 #endif
         fprintf( stderr, "      ENVNAME: %s\n",
                 *opt->env->s?opt->env->s:"\t(none)" );
         fprintf( stderr, "       ENVADD: %s\n", opt->extra->s );
+        fprintf( stderr, "  scan kernel: %s\n", bscan_kernel() );
     }
     if ( askhelp | asklicense | askversion ) {
         if ( askhelp ) {
@@ -608,6 +1594,8 @@ help(char *me)
     printf( "\n" );
     printf( " Example: PATH=`%s -Pb -- \"${HOME:-x}/bin\"`\n", me );
     printf( "    ...add ~/bin to the start of PATH, if it exists.\n" );
+    printf( " Example: eval `%s --batch PATH -Pb -- \"$HOME/bin\" \\\n", me );
+    printf( "               --next MANPATH -P -- /usr/local/man`\n" );
     printf( "\n" );
     printf( "\t%s\n",
         "--before | -b" );
@@ -627,6 +1615,58 @@ help(char *me)
         "--checkpaths | -P" );
     printf( "\t\t%s\n",
                 "Verify that each token as a valid directory." );
+    printf( "\t%s\n",
+        "--samefile" );
+    printf( "\t\t%s\n",
+                "Also drop a token that is the same directory (or file)" );
+    printf( "\t\t%s\n",
+                "as an earlier one, by device and inode: /bin after" );
+    printf( "\t\t%s\n",
+                "/usr/bin when /bin is a symlink to it." );
+    printf( "\t%s\n",
+        "--normalize | --normalize-output" );
+    printf( "\t\t%s\n",
+                "Drop duplicates by spelling of the path without //, /./" );
+    printf( "\t\t%s\n",
+                "or a trailing /, keeping the first one as written (or," );
+    printf( "\t\t%s\n",
+                "with --normalize-output, as normalized)." );
+    printf( "\t%s\n",
+        "--prune | --prune-report" );
+    printf( "\t\t%s\n",
+                "Implies --checkpaths.  Also drop a directory that has" );
+    printf( "\t\t%s\n",
+                "no command an earlier directory does not already have." );
+    printf( "\t\t%s\n",
+                "--prune-report says on stderr which, and why." );
+    printf( "\t%s\n",
+        "--prune-limit N" );
+    printf( "\t\t%s\n",
+                "Keep, unread, a directory of more than N entries." );
+    printf( "\t\t%s\n",
+                "Default is 4096" );
+    printf( "\t%s\n",
+        "--union ENVNAME" );
+    printf( "\t\t%s\n",
+                "Add the list in ENVNAME after the main one.  Repeatable." );
+    printf( "\t%s\n",
+        "--minus ENVNAME" );
+    printf( "\t\t%s\n",
+                "Drop each token that is in the list in ENVNAME." );
+    printf( "\t\t%s\n",
+                "Repeatable." );
+    printf( "\t%s\n",
+        "--intersect ENVNAME" );
+    printf( "\t\t%s\n",
+                "Keep only tokens that are also in the list in ENVNAME" );
+    printf( "\t\t%s\n",
+                "(in every one, if repeated)." );
+    printf( "\t%s\n",
+        "--remove PATTERN" );
+    printf( "\t\t%s\n",
+                "Drop each token that starts with PATTERN or, if it has" );
+    printf( "\t\t%s\n",
+                "* ? [ or \\, matches it as a glob.  Repeatable." );
     printf( "\t%s\n",
         "--delimiter | -F" );
     printf( "\t\t%s\n",
@@ -637,6 +1677,88 @@ help(char *me)
         "--env ENVNAME" );
     printf( "\t\t%s\n",
                 "Explicit setting of ENVNAME." );
+    printf( "\t%s\n",
+        "--jobs N" );
+    printf( "\t\t%s\n",
+                "Check (stat) up to N tokens at once, for slow" );
+    printf( "\t\t%s\n",
+                "(NFS, autofs) filesystems, and dedupe long lists" );
+    printf( "\t\t%s\n",
+                "over N threads.  Default is 1" );
+    printf( "\t%s\n",
+        "--uring" );
+    printf( "\t\t%s\n",
+                "Linux: check all tokens in one io_uring batch," );
+    printf( "\t\t%s\n",
+                "falls back to stat() when io_uring is unavailable." );
+    printf( "\t%s\n",
+        "--cache-ttl SECONDS" );
+    printf( "\t\t%s\n",
+                "Share check results with other cleanpath runs for" );
+    printf( "\t\t%s\n",
+                "SECONDS, through a file in XDG_RUNTIME_DIR." );
+    printf( "\t\t%s\n",
+                "Also set by env CLEANPATH_CACHE_TTL.  Default is 0 (off)" );
+    printf( "\t%s\n",
+        "--no-cache" );
+    printf( "\t\t%s\n",
+                "Do not use the shared cache (or --memo), even if set." );
+    printf( "\t%s\n",
+        "--memo" );
+    printf( "\t\t%s\n",
+                "Keep the whole result in XDG_RUNTIME_DIR, and reuse it" );
+    printf( "\t\t%s\n",
+                "while no directory holding a token has changed." );
+    printf( "\t\t%s\n",
+                "Also set by env CLEANPATH_MEMO=1.  Default is off" );
+    printf( "\t%s\n",
+        "--stdin | --input FILE" );
+    printf( "\t\t%s\n",
+                "Clean a delimited (or line per token) list read from" );
+    printf( "\t\t%s\n",
+                "stdin or FILE instead of ENVNAME, of any size.  Output" );
+    printf( "\t\t%s\n",
+                "is written as it is read, then ENVADD (first with -b)." );
+    printf( "\t%s\n",
+        "--which NAME" );
+    printf( "\t\t%s\n",
+                "Print where the command NAME is found in the result," );
+    printf( "\t\t%s\n",
+                "instead of the result.  Exits 1 if it is not found." );
+    printf( "\t\t%s\n",
+                "Uses an index in XDG_RUNTIME_DIR, see --cache-ttl." );
+    printf( "\t\t%s\n",
+                "A chmod +x of a file already there is not seen until" );
+    printf( "\t\t%s\n",
+                "its directory changes.  Not with --exec." );
+    printf( "\t%s\n",
+        "--batch" );
+    printf( "\t\t%s\n",
+                "Clean several ENVNAMEs at once, each with its own" );
+    printf( "\t\t%s\n",
+                "options and ENVADD, separated by --next.  Prints" );
+    printf( "\t\t%s\n",
+                "NAME='...'; export NAME lines for eval." );
+    printf( "\t\t%s\n",
+                "--jobs, --uring and --cache-ttl come from the first." );
+    printf( "\t%s\n",
+        "--exec COMMAND [ARGS]" );
+    printf( "\t\t%s\n",
+                "Last on the line.  Set ENVNAME (each with --batch)" );
+    printf( "\t\t%s\n",
+                "to the result and run COMMAND in place of cleanpath." );
+    printf( "\t%s\n",
+        "--stats" );
+    printf( "\t\t%s\n",
+                "After the output, print time spent in each phase and" );
+    printf( "\t\t%s\n",
+                "token, lookup and memory counts to stderr." );
+    printf( "\t%s\n",
+        "--trace FILE" );
+    printf( "\t\t%s\n",
+                "Write each phase, stat() and check of the run to FILE" );
+    printf( "\t\t%s\n",
+                "as trace-event JSON (chrome://tracing, Perfetto)." );
     printf( "\t%s\n",
         "--noenv | -X" );
     printf( "\t\t%s\n",
@@ -701,45 +1823,6 @@ help(char *me)
     return;
 }
 
-char *
-elim_mult( char *str, int strlen, struct options *opt )
-{
-    int    crow = 0;
-    char * d    = str;
-    char * s    = str;
-
-    while ( ( ( s - str ) < strlen )
-        && ( opt->delimiter == s[0] ) )
-    {
-        ++s;
-    }
-
-    for( ; (s - str) <= (strz_len_z(str, strlen)+1); s++ ) {
-        if ( opt->delimiter == s[0] ) {
-            crow++;
-            if ( (char)0 == s[1] ) {
-                break;
-            }
-        }
-        else {
-            crow = 0;
-        }
-        if ( 1 >= crow ) {
-            if ( *s != *d ) {
-                *d = *s;
-            }
-            ++d;
-        }
-    }
-
-    while ( s >= d ) {
-        *d = (char)0;
-        ++d;
-    }
-    return str;
-}
-
-
 void
 default_opt( struct options *opt )
 {
@@ -747,12 +1830,29 @@ default_opt( struct options *opt )
     opt->exist     = 0;
     opt->file      = 0;
     opt->dir       = 0;
+    opt->samefile  = 0;
+    opt->normalize = 0;
+    opt->prune     = 0;
+    opt->prune_max = 4096;
     opt->before    = 0;
     opt->debug     = 0;
+    opt->jobs      = 1;
+    opt->uring     = 0;
+    opt->ttl       = 0;
+    opt->memo      = 0;
+    opt->stats     = 0;
+    opt->trace     = NULL;
+    opt->which     = NULL;
+    memset( &opt->unions, 0, sizeof(struct envset) );
+    memset( &opt->minus, 0, sizeof(struct envset) );
+    memset( &opt->isect, 0, sizeof(struct envset) );
+    memset( &opt->remove, 0, sizeof(struct envset) );
+    opt->joined    = NULL;
 #ifndef NO_ARG_MAX
     opt->sizewarn  = 1;
 #endif
     opt->delimiter = ':';
+    opt->input     = NULL;
     opt->extra     = new_bstr(0);
     opt->env       = new_bstr(4);
 
@@ -861,6 +1961,100 @@ set_env( struct options *opt, const char *arg, const char *value )
     return;
 }
 
+int
+set_jobs( struct options *opt, const char *arg, const char *value )
+{
+    char *end = NULL;
+    long jobs = strtol( value, &end, 10 );
+    if ( ( !*value ) || ( *end ) || ( 1 > jobs ) || ( 256 < jobs ) ) {
+        fprintf( stderr, "%s needs a number from 1 to 256 (got '%s')\n",
+            arg, value );
+        return 0;
+    }
+    opt->jobs = (int)jobs;
+#ifdef DEBUG
+    if ( 2 <= opt->debug ) {
+        fprintf( stderr, "    %s: jobs %d\n", arg, opt->jobs );
+    }
+#endif
+    return 1;
+}
+
+int
+set_ttl( struct options *opt, const char *arg, const char *value )
+{
+    char *end = NULL;
+    long ttl = strtol( value, &end, 10 );
+    if ( ( !*value ) || ( *end ) || ( 0 > ttl ) || ( 86400 < ttl ) ) {
+        fprintf( stderr, "%s needs seconds from 0 to 86400 (got '%s')\n",
+            arg, value );
+        return 0;
+    }
+    opt->ttl = (int)ttl;
+#ifdef DEBUG
+    if ( 2 <= opt->debug ) {
+        fprintf( stderr, "    %s: cache ttl %d\n", arg, opt->ttl );
+    }
+#endif
+    return 1;
+}
+
+int
+set_prune_max( struct options *opt, const char *arg, const char *value )
+{
+    char *end = NULL;
+    long max = strtol( value, &end, 10 );
+    if ( ( !*value ) || ( *end ) || ( 1 > max ) || ( 1000000 < max ) ) {
+        fprintf( stderr, "%s needs a number from 1 to 1000000 (got '%s')\n",
+            arg, value );
+        return 0;
+    }
+    opt->prune_max = (int)max;
+#ifdef DEBUG
+    if ( 2 <= opt->debug ) {
+        fprintf( stderr, "    %s: prune limit %d\n", arg, opt->prune_max );
+    }
+#endif
+    return 1;
+}
+
+/* --union, --minus, --intersect ENVNAME (the value is read later), or
+ * --remove PATTERN */
+int
+add_set( struct options *opt, struct envset *set, const char *arg,
+         const char *name )
+{
+    if ( !*name ) {
+        fprintf( stderr, "Used option '%s', but nothing after it.\n", arg );
+        return 0;
+    }
+    if ( set->n + 1 >= set->a ) {
+        int a = set->a ? ( 2 * set->a ) : 4;
+        const char **names = realloc( set->name, a * sizeof(char *) );
+        if ( names ) {
+            set->name = names;
+        }
+        const char **values = realloc( set->value, a * sizeof(char *) );
+        if ( values ) {
+            set->value = values;
+        }
+        if ( ( !names ) || ( !values ) ) {
+            fprintf(stderr, "Fatal: add_set(): %s\n", strerror(errno) );
+            myexit(5);
+        }
+        set->a = a;
+    }
+    set->name[set->n++] = name;
+    set->name[set->n]  = NULL;
+    set->value[set->n] = NULL;
+#ifdef DEBUG
+    if ( 2 <= opt->debug ) {
+        fprintf( stderr, "    %s: %s\n", arg, name );
+    }
+#endif
+    return 1;
+}
+
 /****************************************************************************
  * STRING FUNCTIONS
  */
@@ -889,8 +2083,18 @@ strneqstrn( const char *seek, int seeklen, const char *str, int strlen )
 void
 myexit(int v)
 {
+    trace_done();
+#ifdef CP_BUILTIN
+    free_held();
+#endif
     free_ALL_bstr();
+#ifdef CP_BUILTIN
+    fflush( stdout );
+    cp_bailv = v;
+    longjmp( cp_bail, 1 );
+#else
     exit(v);
+#endif
 }
 
 void
@@ -0,0 +1,141 @@
+#ifndef VOLLINK_CLEANPATH_H
+#define VOLLINK_CLEANPATH_H
+
+#include <stddef.h>
+
+/*
+ * libcleanpath: everything cleanpath does to a delimited list, without
+ * the command line.  Each struct cleanpath is a context of its own, so
+ * threads can each run one.  Nothing in here calls exit(), errors come
+ * back as -1 with errno set (ENOMEM or EINVAL).
+ *
+ *     struct cleanpath cp;
+ *     cleanpath_init( &cp );
+ *     cp.input  = getenv("PATH");
+ *     cp.extra  = "/usr/local/bin";
+ *     cp.checks = CLEANPATH_DIRS;
+ *     if ( 0 == cleanpath_run( &cp ) ) {
+ *         setenv( "PATH", cp.out, 1 );
+ *     }
+ *     cleanpath_free( &cp );
+ */
+
+#define CLEANPATH_EXISTS    0x01    // Token must exist (-e)
+#define CLEANPATH_DIRS      0x02    // Token must be a directory (-P)
+#define CLEANPATH_FILES     0x04    // Token must be a regular file (-f)
+#define CLEANPATH_SAMEFILE  0x08    // Drop a token that is the same file
+                                    // (st_dev, st_ino) as an earlier one
+#define CLEANPATH_PRUNE     0x10    // Drop a directory with no command
+                                    // that an earlier one does not have
+#define CLEANPATH_REPORT    0x20    // Say on stderr what PRUNE dropped
+#define CLEANPATH_MEMO      0x40    // Each result is kept in XDG_RUNTIME_DIR
+                                    // (memo.h), and queue() hands it back
+                                    // (finish() then has nothing to do)
+                                    // while no directory it depends on
+                                    // has changed
+#define CLEANPATH_NORMALIZE 0x80    // Dedupe on the lexically normalized
+                                    // token (bscan_path()), keeping the
+                                    // first one's own spelling
+#define CLEANPATH_NORMOUT   0x100   // NORMALIZE, and output that spelling
+
+/* Lookups shared by several contexts, so that a path named in more than
+ * one list is only checked once.  Keeps its own copy of each path. */
+typedef struct cleanpath_stats cleanpath_stats;
+typedef struct cleanpath_work  cleanpath_work;
+
+/* Where the time went and what was found, summed over every run (or
+ * feed) of a context.  Times are CLOCK_MONOTONIC nanoseconds. */
+struct cleanpath_count {
+    unsigned long long concat_ns;   // Joining input and extra
+    unsigned long long split_ns;    // Finding the tokens
+    unsigned long long dedupe_ns;
+    unsigned long long stat_ns;     // Lookups, for every context sharing
+    unsigned long long check_ns;    // Checks, and joining out
+    long    tokens_in;      // Not counting empty ones
+    long    empty;          // Redundant delimiters
+    long    dupes;
+    long    tokens_out;
+    long    lookups;        // Paths looked up
+    long    stat_calls;     // Of those, not answered by the shared cache
+    long    stat_fail;      // Looked up, did not exist
+    long    check_fail;     // Tokens dropped by a check
+    long    samefile;       // Tokens dropped by CLEANPATH_SAMEFILE
+    long    pruned;         // Directories dropped by CLEANPATH_PRUNE
+    long    dirents;        // Entries PRUNE read
+    long    memo;           // Runs answered by CLEANPATH_MEMO
+    long    filtered;       // Tokens dropped by minus or intersect
+    long    removed;        // Tokens dropped by a remove pattern
+    long    normalized;     // Tokens NORMALIZE spelled differently
+};
+
+struct cleanpath {
+    /* Set by the caller, after cleanpath_init() sets the defaults */
+    const char *    input;      // List to clean (ENVNAME's value) or NULL
+    const char *    extra;      // More tokens (ENVADD) or NULL
+    int             before;     // extra goes ahead of input
+    const char * const *minus;  // Lists (split on delimiter) whose
+                                // tokens are dropped, NULL ended, or NULL
+    const char * const *intersect;  // Lists a token must be in, every
+                                // one of them, to be kept, likewise
+    const char * const *remove; // Patterns (pmatch.h), a token matching
+                                // any is dropped, NULL ended, or NULL
+    char            delimiter;  // ':'
+    int             checks;     // CLEANPATH_* flags, 0
+    int             jobs;       // stat() threads (tstat.h), and dedupe
+                                // ones for a long list (shard.h), 1
+    int             uring;      // io_uring statx (tstat.h), 0
+    int             ttl;        // Shared cache seconds (scache.h), 0
+    int             prune_max;  // PRUNE reads this many entries of a
+                                // directory, then keeps it, 4096
+    int             debug;      // Narrate to stderr, 0
+    cleanpath_stats *stats;     // Shared lookups, NULL for private ones
+
+    /* Results, owned by the context */
+    char *          out;        // NUL terminated
+    size_t          outlen;
+    struct cleanpath_count count;
+
+    cleanpath_work *work;       // Private
+};
+
+/* The library is built with -fvisibility=hidden, only these are seen
+ * from outside it */
+#if defined(__GNUC__)
+#pragma GCC visibility push(default)
+#endif
+
+void    cleanpath_init( struct cleanpath *cp );
+void    cleanpath_free( struct cleanpath *cp );
+        // Clean input and extra into out, 0 or -1
+int     cleanpath_run( struct cleanpath *cp );
+        // cleanpath_run() in two halves: queue() splits, dedupes and
+        // queues lookups in cp->stats, finish() does every lookup still
+        // queued in cp->stats (for ANY context) then fills in out.
+int     cleanpath_queue( struct cleanpath *cp );
+int     cleanpath_finish( struct cleanpath *cp );
+        // Streaming: the new tokens among the complete ones in buf are
+        // appended to out (the caller empties it, outlen = 0, as it
+        // likes).  The last token is only complete if final is set.
+        // Newlines also separate tokens.  buf is modified.
+        // Returns the bytes of buf used, the rest must be fed again.
+long    cleanpath_feed( struct cleanpath *cp, char *buf, size_t len,
+                        int final );
+
+        // Full path of the command name, found through out (so after
+        // cleanpath_run()), into buf.  Answered from an index kept in
+        // XDG_RUNTIME_DIR (rebuilt when out or a directory changes,
+        // trusted for ttl seconds).  1 found, 0 not, -1 error (errno).
+int     cleanpath_which( struct cleanpath *cp, const char *name,
+                         char *buf, size_t bufl );
+
+cleanpath_stats * cleanpath_stats_new();
+        // Only after every context using it is done with it
+void    cleanpath_stats_free( cleanpath_stats *stats );
+
+const char * cleanpath_version();
+
+#if defined(__GNUC__)
+#pragma GCC visibility pop
+#endif
+
+#endif
@@ -0,0 +1,5 @@
+#include <linux/limits.h>
+#include <sys/stat.h>
+#define HAVE_PTHREAD 1
+#define HAVE_IO_URING 1
+#define HAVE_CPU_DISPATCH 1
@@ -0,0 +1,29 @@
+LDLIBS=-pthread
+# Usable CC
+CC=gcc
+CCFLAGS=-g -O2 -Wall -std=gnu99
+
+
+#########
+## User Configurable Values
+#########
+
+# If a prefix isn't set, make won't install
+prefix=
+bindir=bin
+
+# Do Not Set Here, for reference only:
+# INSTALLDIR=$(DESTDIR)/$(prefix)/$(bindir)/
+
+# NOTE: DESTDIR is typically reserved for package
+#       managers or chroot environment setups.
+
+# MacOS - Set a code signing signature name here.
+# SIGNID=CompanyName Releases
+SIGNID=
+# MacOS/Sign - If signature is in a non-standard keychain:
+# CHAIN=Offline.keychain-db
+CHAIN=
+
+# vim: ft=make
+# EOF configure.mk
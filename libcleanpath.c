@@ -0,0 +1,1482 @@
+#define LIBCLEANPATH_VERSION "0.01"
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "configure.h"
+
+#include "bscan.h"
+#include "bhash.h"
+#include "tstat.h"
+#include "trace.h"
+#include "cindex.h"
+#include "memo.h"
+#include "pmatch.h"
+#include "shard.h"
+#include "cleanpath.h"
+
+/* One token of the combined input, by position in the input buffer */
+struct token {
+    int     s;      // Offset
+    int     l;      // Length
+    int     k;      // Length of its key (at s in keys), l unless normalized
+    int     drop;   // Non-zero if it will not be in the output
+    int     st;     // Index of its stat() result in a cleanpath_stats
+};
+
+struct toklist {
+    struct token *t;
+    int     n;      // Used
+    int     a;      // Allocated
+};
+
+/* The checks that need each token looked up */
+#define CP_LOOKUPS  ( CLEANPATH_EXISTS | CLEANPATH_DIRS | CLEANPATH_FILES \
+                    | CLEANPATH_SAMEFILE | CLEANPATH_PRUNE )
+
+/* With jobs, a list this long is deduped in shards (shard.h) */
+#define CP_SHARD_MIN    65536
+
+/* Path copies for cleanpath_stats, never moved once written */
+#define KEEP_BLOCK 65536
+
+struct keepblock {
+    struct keepblock *next;
+    size_t  used;
+    size_t  a;
+    char    s[];
+};
+
+struct cleanpath_stats {
+    bhash   seen;   // Path to index in paths[] and st[]
+    const char **paths;
+    struct tstat *st;
+    int     n;      // Queued
+    int     done;   // Already looked up
+    int     a;      // Allocated
+    struct keepblock *keep;
+};
+
+struct cleanpath_work {
+    char *  whole;  // input and extra, delimiters become NUL
+    size_t  wl;
+    char *  norm;   // NORMALIZE: whole, each token normalized; streaming:
+    size_t  na;     // one token's key
+    const char *keys;   // Dedupe keys by token offset, whole or norm
+    struct toklist toks;
+    cleanpath_stats *own;   // When the caller gave no cp->stats
+    size_t  outa;
+    /* minus and intersect, keys live in setbuf */
+    char *  setbuf;
+    bhash   minus;
+    bhash   isect;  // Value is how many lists in a row had it
+    int     nisect; // Lists, a token is kept if its value is this
+    pmatch *pm;     // remove, all patterns at once
+    /* Streaming only */
+    bhash   seen;   // Tokens already fed, keys live in the stats
+    int *   pend;   // New tokens of one feed, as stats indexes
+    int     np;
+    int     pa;
+    size_t  fed;    // Tokens put in out, over every feed
+    int     sets;   // _cp_sets() is done
+    bhash   inodes; // CLEANPATH_SAMEFILE, keys live in the stats
+    bhash   names;  // CLEANPATH_PRUNE, commands in the kept directories
+    /* CLEANPATH_MEMO, from queue() to finish() */
+    char *  memokey;    // A miss to store once out is done
+    size_t  memokl;
+    time_t  began;      // Before any lookup, see memo_put()
+    int     memohit;    // out came from the memo, finish() has nothing to do
+};
+
+unsigned long long
+_cp_ns()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ( (unsigned long long)ts.tv_sec * 1000000000ULL ) + ts.tv_nsec;
+}
+
+/****************************************************************************
+ * Shared lookups
+ */
+cleanpath_stats *
+cleanpath_stats_new()
+{
+    cleanpath_stats *set = calloc( 1, sizeof(cleanpath_stats) );
+    if ( !set ) {
+        return NULL;
+    }
+    if ( bhash_init( &set->seen, 64 ) ) {
+        free( set );
+        return NULL;
+    }
+    return set;
+}
+
+void
+cleanpath_stats_free( cleanpath_stats *set )
+{
+    if ( !set ) {
+        return;
+    }
+    while ( set->keep ) {
+        struct keepblock *next = set->keep->next;
+        free( set->keep );
+        set->keep = next;
+    }
+    bhash_free( &set->seen );
+    free( set->paths );
+    free( set->st );
+    free( set );
+    return;
+}
+
+const char *
+_cp_keep( cleanpath_stats *set, const char *path, size_t len )
+{
+    struct keepblock *kb = set->keep;
+    char *copy;
+    if ( ( !kb ) || ( ( kb->a - kb->used ) < ( len + 1 ) ) ) {
+        size_t a = KEEP_BLOCK;
+        if ( a < ( len + 1 ) ) {
+            a = len + 1;
+        }
+        kb = malloc( sizeof(struct keepblock) + a );
+        if ( !kb ) {
+            return NULL;
+        }
+        kb->next  = set->keep;
+        kb->used  = 0;
+        kb->a     = a;
+        set->keep = kb;
+    }
+    copy = kb->s + kb->used;
+    memcpy( copy, path, len );
+    copy[len] = (char)0;
+    kb->used += len + 1;
+    return copy;
+}
+
+/* Index of path in set->st, queueing it if it is new, -1 on error */
+int
+_cp_stats_add( cleanpath_stats *set, const char *path, int len )
+{
+    uint32_t h = bhash_sum( path, len );
+    bhent *have = bhash_find( &set->seen, path, len, h );
+    const char *copy;
+
+    if ( have ) {
+        return have->v;
+    }
+    if ( set->n == set->a ) {
+        int a = set->a ? ( 2 * set->a ) : 64;
+        const char **paths = realloc( set->paths, a * sizeof(char *) );
+        if ( paths ) {
+            set->paths = paths;
+        }
+        struct tstat *st = realloc( set->st, a * sizeof(struct tstat) );
+        if ( st ) {
+            set->st = st;
+        }
+        if ( ( !paths ) || ( !st ) ) {
+            return -1;
+        }
+        set->a = a;
+    }
+    copy = _cp_keep( set, path, len );
+    if ( ( !copy ) || ( -1 == bhash_add( &set->seen, copy, len, set->n, NULL ) ) )
+    {
+        return -1;
+    }
+    set->paths[set->n] = copy;
+    return set->n++;
+}
+
+/* stat() everything queued since the last time */
+int
+_cp_stats_run( struct cleanpath *cp, cleanpath_stats *set )
+{
+    int todo = set->n - set->done;
+    if ( 0 < todo ) {
+        unsigned long long t0 = _cp_ns();
+        int cx;
+        if ( cp->debug ) {
+            fprintf( stderr, "statrun(): stat() %d tokens, %d jobs\n",
+                todo, cp->jobs );
+        }
+        struct tstat_how how;
+        how.jobs  = cp->jobs;
+        how.uring = cp->uring;
+        how.ttl   = cp->ttl;
+        cp->count.stat_calls += tstat_batch( set->paths + set->done,
+                                    set->st + set->done, todo, &how );
+        cp->count.lookups += todo;
+        for ( cx = set->done; cx < set->n; cx++ ) {
+            if ( -1 == set->st[cx].ret ) {
+                cp->count.stat_fail++;
+            }
+        }
+        set->done = set->n;
+        cp->count.stat_ns += _cp_ns() - t0;
+        trace_span( "lookups", t0, NULL, 0, todo );
+    }
+    return todo;
+}
+
+cleanpath_stats *
+_cp_stats( struct cleanpath *cp )
+{
+    if ( cp->stats ) {
+        return cp->stats;
+    }
+    if ( !cp->work->own ) {
+        cp->work->own = cleanpath_stats_new();
+    }
+    return cp->work->own;
+}
+
+/****************************************************************************
+ * Context
+ */
+void
+cleanpath_init( struct cleanpath *cp )
+{
+    memset( cp, 0, sizeof(struct cleanpath) );
+    cp->delimiter = ':';
+    cp->jobs      = 1;
+    cp->prune_max = 4096;
+    return;
+}
+
+void
+cleanpath_free( struct cleanpath *cp )
+{
+    if ( cp->work ) {
+        free( cp->work->whole );
+        free( cp->work->norm );
+        free( cp->work->toks.t );
+        free( cp->work->pend );
+        free( cp->work->setbuf );
+        pmatch_free( cp->work->pm );
+        bhash_free( &cp->work->minus );
+        bhash_free( &cp->work->isect );
+        bhash_free( &cp->work->seen );
+        bhash_free( &cp->work->inodes );
+        bhash_free( &cp->work->names );
+        cleanpath_stats_free( cp->work->own );
+        free( cp->work->memokey );
+        free( cp->work );
+    }
+    free( cp->out );
+    cp->work   = NULL;
+    cp->out    = NULL;
+    cp->outlen = 0;
+    return;
+}
+
+int
+_cp_work( struct cleanpath *cp )
+{
+    if ( !cp->work ) {
+        cp->work = calloc( 1, sizeof(cleanpath_work) );
+        if ( !cp->work ) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* out has room for need more bytes and a NUL */
+int
+_cp_outroom( struct cleanpath *cp, size_t need )
+{
+    cleanpath_work *w = cp->work;
+    if ( ( cp->outlen + need + 1 ) > w->outa ) {
+        size_t a = w->outa ? w->outa : 256;
+        char *grow;
+        while ( a < ( cp->outlen + need + 1 ) ) {
+            a *= 2;
+        }
+        grow = realloc( cp->out, a );
+        if ( !grow ) {
+            return -1;
+        }
+        cp->out = grow;
+        w->outa = a;
+    }
+    return 0;
+}
+
+/*
+ * remove compiled into one matcher, minus and intersect as hash sets,
+ * each list copied into setbuf and
+ * split in place.  A token of the k-th intersect list only counts if
+ * the k-1 before all had it, so after the last the ones in every list
+ * are those with nisect.  0 or -1.
+ */
+int
+_cp_sets( struct cleanpath *cp )
+{
+    cleanpath_work *w = cp->work;
+    const char * const *lx;
+    size_t  total = 0;
+    size_t  at = 0;
+    int     nminus = 0;
+    int     k = 0;
+
+    free( w->setbuf );
+    bhash_free( &w->minus );
+    bhash_free( &w->isect );
+    pmatch_free( w->pm );
+    w->setbuf = NULL;
+    w->pm     = NULL;
+    w->nisect = 0;
+    for ( lx = cp->remove; lx && *lx; lx++ ) {
+        k++;
+    }
+    if ( k ) {
+        w->pm = pmatch_new( cp->remove, k );
+        if ( !w->pm ) {
+            return -1;
+        }
+    }
+    for ( lx = cp->minus; lx && *lx; lx++ ) {
+        total += strlen( *lx ) + 1;
+        nminus++;
+    }
+    for ( lx = cp->intersect; lx && *lx; lx++ ) {
+        total += strlen( *lx ) + 1;
+        w->nisect++;
+    }
+    if ( ( !nminus ) && ( !w->nisect ) ) {
+        return 0;
+    }
+    w->setbuf = malloc( total );
+    if ( ( !w->setbuf ) || bhash_init( &w->minus, 64 )
+        || bhash_init( &w->isect, 64 ) )
+    {
+        return -1;
+    }
+    for ( k = 0; k < nminus + w->nisect; k++ ) {
+        const char *list = ( k < nminus ) ? cp->minus[k]
+                                          : cp->intersect[k - nminus];
+        size_t  l = strlen( list );
+        size_t  start;
+        size_t  end;
+        char   *buf = w->setbuf + at;
+
+        memcpy( buf, list, l + 1 );
+        at += l + 1;
+        for ( start = 0; start < l; start = end + 1 ) {
+            end = start + bscan_chr( buf + start, l - start, cp->delimiter );
+            buf[end] = (char)0;
+            if ( end == start ) {
+                continue;
+            }
+            if ( k < nminus ) {
+                if ( -1 == bhash_add( &w->minus, buf + start, end - start,
+                                      0, NULL ) )
+                {
+                    return -1;
+                }
+            }
+            else if ( k == nminus ) {
+                if ( -1 == bhash_add( &w->isect, buf + start, end - start,
+                                      1, NULL ) )
+                {
+                    return -1;
+                }
+            }
+            else {
+                bhent *have = bhash_find( &w->isect, buf + start,
+                    end - start, bhash_sum( buf + start, end - start ) );
+                if ( ( have ) && ( have->v == k - nminus ) ) {
+                    have->v++;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+/* 0 keeps token, minus or intersect drop it with 1, remove with 2,
+ * -1 on allocation failure.  Each is counted. */
+int
+_cp_filter( struct cleanpath *cp, const char *token, size_t len )
+{
+    cleanpath_work *w = cp->work;
+    uint32_t h;
+    bhent  *have;
+    int     drop = 0;
+
+    if ( w->pm ) {
+        drop = pmatch_test( w->pm, token, len );
+        if ( -1 == drop ) {
+            return -1;
+        }
+        if ( drop ) {
+            cp->count.removed++;
+            trace_mark( "removed", token, len, 0 );
+            return 2;
+        }
+    }
+    if ( !w->setbuf ) {
+        return 0;
+    }
+    h = bhash_sum( token, len );
+    if ( w->minus.n && bhash_find( &w->minus, token, len, h ) ) {
+        drop = 1;
+    }
+    else if ( w->nisect ) {
+        have = bhash_find( &w->isect, token, len, h );
+        drop = ( ( !have ) || ( have->v != w->nisect ) );
+    }
+    if ( drop ) {
+        cp->count.filtered++;
+        trace_mark( "filtered", token, len, 0 );
+    }
+    return drop;
+}
+
+int
+_cp_token_check( struct cleanpath *cp, const char *token,
+                 const struct tstat *ts )
+{
+    int modefail = 0;
+    int file = ( cp->checks & CLEANPATH_FILES );
+    int dir  = ( cp->checks & CLEANPATH_DIRS );
+    if ( cp->checks & ( CLEANPATH_EXISTS | CLEANPATH_DIRS | CLEANPATH_FILES ) ) {
+        if ( -1 == ts->ret ) {
+            if ( cp->debug ) {
+                fprintf( stderr, "token_check(): Not exists: \"%s\"\n",
+                    token );
+            }
+            modefail = 7;
+        }
+        /* file and dir checks below here, everything else, add above */
+        else if ( file && dir ) {
+            /* If BOTH are set, BOTH of these have to fail */
+            if (   ( S_IFDIR != ( ts->mode & S_IFMT ) )
+                && ( S_IFREG != ( ts->mode & S_IFMT ) ) )
+            {
+                if ( cp->debug ) {
+                    fprintf( stderr, "token_check(): Not a regular file or dir: \"%s\"\n",
+                        token );
+                }
+                modefail = 3;
+            }
+        }
+        else if ( ( file )
+            && ( S_IFREG != ( ts->mode & S_IFMT ) ) )
+        {
+            if ( cp->debug ) {
+                fprintf( stderr, "token_check(): Not a regular file: \"%s\"\n", token );
+            }
+            modefail = 2;
+        }
+        else if ( ( dir )
+            && ( S_IFDIR != ( ts->mode & S_IFMT ) ) )
+        {
+            if ( cp->debug ) {
+                fprintf( stderr, "token_check(): Not a directory: \"%s\"\n", token );
+            }
+            modefail = 1;
+        }
+        trace_mark( "token_check", token, strlen( token ), modefail );
+    }
+    return (modefail);
+}
+
+/*
+ * CLEANPATH_SAMEFILE: 1 if ts is the same (st_dev, st_ino) as a token
+ * already in inodes, else it is added (as index v).  A token that does
+ * not exist is never the same as anything.  -1 on allocation failure.
+ */
+int
+_cp_samefile( struct cleanpath *cp, bhash *inodes, const char *token,
+              const struct tstat *ts, int v )
+{
+    char    key[sizeof(dev_t) + sizeof(ino_t)];
+    const char *keep;
+    bhent  *first;
+    uint32_t h;
+
+    if ( -1 == ts->ret ) {
+        return 0;
+    }
+    memcpy( key, &ts->dev, sizeof(dev_t) );
+    memcpy( key + sizeof(dev_t), &ts->ino, sizeof(ino_t) );
+    h = bhash_sum( key, sizeof(key) );
+    first = bhash_find( inodes, key, sizeof(key), h );
+    if ( first ) {
+        if ( cp->debug ) {
+            fprintf( stderr, "same file token: (%d) of (%d) [%s] (removing)\n",
+                v, first->v, token );
+        }
+        trace_mark( "samefile", token, strlen( token ), first->v );
+        cp->count.samefile++;
+        return 1;
+    }
+    /* The set keeps pointers, the stats keep the bytes */
+    keep = _cp_keep( _cp_stats( cp ), key, sizeof(key) );
+    if ( ( !keep ) || ( -1 == bhash_add( inodes, keep, sizeof(key), v, NULL ) ) )
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * CLEANPATH_PRUNE: 1 if dir has no command that is not already in names
+ * (the commands of the directories kept ahead of it), else its new ones
+ * are added to names.  Only an entry whose name is not in names yet is
+ * looked at past readdir().  A directory that can not be read, or has
+ * more than prune_max entries, is kept.  -1 on allocation failure.
+ */
+int
+_cp_prune( struct cleanpath *cp, bhash *names, const char *dir )
+{
+    DIR    *dh;
+    struct dirent *de;
+    int     dfd;
+    int     read  = 0;
+    int     added = 0;
+    int     known = 0;
+    int     big   = 0;
+
+    dh = opendir( dir );
+    if ( !dh ) {
+        return 0;
+    }
+    dfd = dirfd( dh );
+    while ( ( de = readdir( dh ) ) ) {
+        const char *name = de->d_name;
+        const char *keep;
+        size_t l;
+        uint32_t h;
+        if ( ++read > cp->prune_max ) {
+            big = 1;
+            break;
+        }
+        if ( ( DT_DIR == de->d_type ) || ( 0 == strcmp( ".", name ) )
+            || ( 0 == strcmp( "..", name ) ) )
+        {
+            continue;
+        }
+        l = strlen( name );
+        h = bhash_sum( name, l );
+        if ( bhash_find( names, name, l, h ) ) {
+            known++;
+            continue;
+        }
+        if ( !tstat_command( dfd, name, de->d_type ) ) {
+            continue;
+        }
+        keep = _cp_keep( _cp_stats( cp ), name, l );
+        if ( ( !keep ) || ( -1 == bhash_add( names, keep, l, 0, NULL ) ) ) {
+            closedir( dh );
+            return -1;
+        }
+        added++;
+    }
+    closedir( dh );
+    cp->count.dirents += read;
+    if ( added || big ) {
+        return 0;
+    }
+    if ( cp->debug || ( cp->checks & CLEANPATH_REPORT ) ) {
+        if ( known ) {
+            fprintf( stderr, "cleanpath: pruned %s: every command (%d) is"
+                " found earlier\n", dir, known );
+        }
+        else {
+            fprintf( stderr, "cleanpath: pruned %s: no commands\n", dir );
+        }
+    }
+    trace_mark( "pruned", dir, strlen( dir ), known );
+    cp->count.pruned++;
+    return 1;
+}
+
+/*
+ * Join input and extra (in the requested order), then one scan over
+ * the result, recording the offset and length of each token.  Each
+ * delimiter is overwritten with a NUL so that each token can be used in
+ * place as a C string.  Empty tokens (redundant delimiters) are never
+ * recorded.
+ */
+int
+_cp_tokenize( struct cleanpath *cp )
+{
+    cleanpath_work *w = cp->work;
+    struct toklist *toks = &w->toks;
+    const char *first = cp->before ? cp->extra : cp->input;
+    const char *second = cp->before ? cp->input : cp->extra;
+    size_t l1 = first ? strlen( first ) : 0;
+    size_t l2 = second ? strlen( second ) : 0;
+    size_t start;
+    size_t end;
+    size_t l;
+    unsigned long long t0 = _cp_ns();
+
+    free( w->whole );
+    w->wl = l1 + 1 + l2;
+    w->whole = malloc( w->wl + 1 );
+    if ( !w->whole ) {
+        return -1;
+    }
+    if ( l1 ) {
+        memcpy( w->whole, first, l1 );
+    }
+    w->whole[l1] = cp->delimiter;
+    if ( l2 ) {
+        memcpy( w->whole + l1 + 1, second, l2 );
+    }
+    w->whole[w->wl] = (char)0;
+    if ( cp->debug ) {
+        fprintf(stderr, "Concat ENV and ENVADD => \"%s\"\n", w->whole);
+    }
+    cp->count.concat_ns += _cp_ns() - t0;
+    trace_span( "concat", t0, NULL, 0, 0 );
+    t0 = _cp_ns();
+
+    toks->n = 0;
+    if ( !toks->t ) {
+        toks->a = 16;
+        toks->t = malloc( toks->a * sizeof(struct token) );
+        if ( !toks->t ) {
+            return -1;
+        }
+    }
+    for ( start = 0; start < w->wl; start = end + 1 ) {
+        end = start + bscan_chr( w->whole + start, w->wl - start,
+                                 cp->delimiter );
+        w->whole[end] = (char)0;
+        if ( end == start ) {
+            cp->count.empty++;
+            continue;
+        }
+        if ( toks->n == toks->a ) {
+            struct token *grow;
+            grow = realloc( toks->t, 2 * toks->a * sizeof(struct token) );
+            if ( !grow ) {
+                return -1;
+            }
+            toks->t = grow;
+            toks->a *= 2;
+        }
+        l = end - start;
+        if ( cp->checks & CLEANPATH_NORMOUT ) {
+            /* In place, the token only ever gets shorter */
+            l = bscan_path( w->whole + start, end - start );
+            if ( l < ( end - start ) ) {
+                w->whole[start + l] = (char)0;
+                cp->count.normalized++;
+            }
+        }
+        toks->t[toks->n].s    = start;
+        toks->t[toks->n].l    = l;
+        toks->t[toks->n].k    = l;
+        toks->t[toks->n].drop = 0;
+        toks->t[toks->n].st   = -1;
+        toks->n++;
+    }
+    /* With nothing ahead of it, the delimiter joining the two made an
+     * empty token of its own, the list did not have it */
+    if ( !l1 ) {
+        cp->count.empty--;
+    }
+    /* NORMALIZE alone: the keys are a normalized copy, out keeps the
+     * spelling of whole */
+    w->keys = w->whole;
+    if ( ( cp->checks & CLEANPATH_NORMALIZE )
+        && ( !( cp->checks & CLEANPATH_NORMOUT ) ) )
+    {
+        int cx;
+        if ( w->na < ( w->wl + 1 ) ) {
+            free( w->norm );
+            w->na = w->wl + 1;
+            w->norm = malloc( w->na );
+            if ( !w->norm ) {
+                w->na = 0;
+                return -1;
+            }
+        }
+        memcpy( w->norm, w->whole, w->wl + 1 );
+        for ( cx = 0; cx < toks->n; cx++ ) {
+            struct token *tok = &toks->t[cx];
+            tok->k = bscan_path( w->norm + tok->s, tok->l );
+            if ( tok->k < tok->l ) {
+                w->norm[tok->s + tok->k] = (char)0;
+                cp->count.normalized++;
+            }
+        }
+        w->keys = w->norm;
+    }
+    cp->count.tokens_in += toks->n;
+    cp->count.split_ns += _cp_ns() - t0;
+    trace_span( "split", t0, NULL, 0, toks->n );
+    if ( cp->debug ) {
+        fprintf( stderr, "tokenize(): %d tokens\n", toks->n );
+    }
+    return toks->n;
+}
+
+/* firsts[cx] is the token cx is a duplicate of, cx if it is the first */
+int
+_cp_shard( struct cleanpath *cp, int **firsts )
+{
+    struct toklist *toks = &cp->work->toks;
+    struct shard_key *keys;
+    int     cx;
+    int     ret;
+
+    *firsts = malloc( toks->n * sizeof(int) );
+    keys = malloc( toks->n * sizeof(struct shard_key) );
+    if ( ( !*firsts ) || ( !keys ) ) {
+        free( keys );
+        return -1;
+    }
+    for ( cx = 0; cx < toks->n; cx++ ) {
+        keys[cx].s = toks->t[cx].s;
+        keys[cx].l = toks->t[cx].k;
+    }
+    if ( cp->debug ) {
+        fprintf( stderr, "queue(): dedupe %d tokens, %d jobs\n",
+            toks->n, cp->jobs );
+    }
+    ret = shard_first( cp->work->keys, keys, toks->n, cp->jobs, *firsts );
+    free( keys );
+    return ret;
+}
+
+/*
+ * Mark duplicates (keeping the first), and queue each unique token in
+ * the stats if it will need a check.  Nothing moves, finish() builds
+ * the output afterward.  A long list with jobs is deduped over that
+ * many threads first, the rest is in order either way.
+ */
+/* CLEANPATH_MEMO, further down */
+int     _cp_memo_get( struct cleanpath *cp );
+void    _cp_memo_put( struct cleanpath *cp, const char *key, size_t keylen,
+                      time_t began );
+
+int
+cleanpath_queue( struct cleanpath *cp )
+{
+    bhash   seen;
+    bhent  *first;
+    int    *firsts = NULL;
+    int     cx;
+    int     drop;
+    cleanpath_stats *stats;
+    struct toklist *toks;
+    unsigned long long t0;
+    int     hit;
+
+    if ( _cp_work( cp ) ) {
+        errno = ENOMEM;
+        return -1;
+    }
+    hit = _cp_memo_get( cp );
+    if ( hit ) {
+        return ( 1 == hit ) ? 0 : -1;
+    }
+    if ( 0 > _cp_tokenize( cp ) ) {
+        errno = ENOMEM;
+        return -1;
+    }
+    t0 = _cp_ns();
+    toks = &cp->work->toks;
+    stats = _cp_stats( cp );
+    memset( &seen, 0, sizeof(seen) );
+    if ( ( !stats ) || _cp_sets( cp ) ) {
+        errno = ENOMEM;
+        return -1;
+    }
+    if ( ( 1 < cp->jobs ) && ( CP_SHARD_MIN <= toks->n ) ) {
+        if ( _cp_shard( cp, &firsts ) ) {
+            goto nomem;
+        }
+    }
+    else if ( bhash_init( &seen, toks->n ) ) {
+        goto nomem;
+    }
+    for ( cx = 0; cx < toks->n; cx++ ) {
+        struct token *tok = &toks->t[cx];
+        const char *str = cp->work->whole + tok->s;
+        int was;
+        if ( firsts ) {
+            was = firsts[cx];
+        }
+        else {
+            int added = bhash_add( &seen, cp->work->keys + tok->s, tok->k,
+                                   cx, &first );
+            if ( -1 == added ) {
+                goto nomem;
+            }
+            was = first->v;
+        }
+        if ( was != cx ) {
+            if ( cp->debug ) {
+                fprintf( stderr, "duplicate token: (%d) of (%d) [%s] (removing)\n",
+                    cx, was, str );
+            }
+            tok->drop = 1;
+            cp->count.dupes++;
+            trace_mark( "duplicate", str, tok->l, was );
+            continue;
+        }
+        drop = _cp_filter( cp, str, tok->l );
+        if ( -1 == drop ) {
+            goto nomem;
+        }
+        if ( drop ) {
+            if ( cp->debug ) {
+                fprintf( stderr, "%s token: (%d) [%s] (removing)\n",
+                    ( 2 == drop ) ? "removed" : "filtered", cx, str );
+            }
+            tok->drop = 1;
+            continue;
+        }
+        if ( cp->checks & CP_LOOKUPS ) {
+            tok->st = _cp_stats_add( stats, str, tok->l );
+            if ( -1 == tok->st ) {
+                goto nomem;
+            }
+        }
+    }
+    bhash_free( &seen );
+    free( firsts );
+    cp->count.dedupe_ns += _cp_ns() - t0;
+    trace_span( "dedupe", t0, NULL, 0, 0 );
+    return 0;
+
+nomem:
+    bhash_free( &seen );
+    free( firsts );
+    errno = ENOMEM;
+    return -1;
+}
+
+/* Drop each token that fails a check, and join the rest into out */
+int
+cleanpath_finish( struct cleanpath *cp )
+{
+    int     cx;
+    cleanpath_stats *stats;
+    struct toklist *toks;
+    unsigned long long t0;
+    bhash   inodes;
+    bhash   names;
+
+    if ( ( cp->work ) && ( cp->work->memohit ) ) {
+        return 0;
+    }
+    if ( ( !cp->work ) || ( !cp->work->whole ) ) {
+        errno = EINVAL;
+        return -1;
+    }
+    toks  = &cp->work->toks;
+    stats = _cp_stats( cp );
+    if ( cp->checks & CP_LOOKUPS ) {
+        _cp_stats_run( cp, stats );
+    }
+    t0 = _cp_ns();
+    cp->outlen = 0;
+    /* The whole input is the most out could need */
+    if ( _cp_outroom( cp, cp->work->wl ) ) {
+        errno = ENOMEM;
+        return -1;
+    }
+    memset( &inodes, 0, sizeof(inodes) );
+    memset( &names, 0, sizeof(names) );
+    if ( ( ( cp->checks & CLEANPATH_SAMEFILE )
+            && bhash_init( &inodes, toks->n ) )
+        || ( ( cp->checks & CLEANPATH_PRUNE )
+            && bhash_init( &names, 1024 ) ) )
+    {
+        bhash_free( &inodes );
+        errno = ENOMEM;
+        return -1;
+    }
+    for ( cx = 0; cx < toks->n; cx++ ) {
+        struct token *tok = &toks->t[cx];
+        const char *str = cp->work->whole + tok->s;
+        if ( tok->drop ) {
+            continue;
+        }
+        if ( cp->debug ) {
+            fprintf( stderr, "EVALUATE (%d) [%s]\n", cx, str );
+        }
+        if ( ( cp->checks & CP_LOOKUPS )
+            && _cp_token_check( cp, str, &stats->st[tok->st] ) )
+        {
+            if ( cp->debug ) {
+                fprintf( stderr, "finish(): Removed (%d)[%s]\n", cx, str );
+            }
+            tok->drop = 1;
+            cp->count.check_fail++;
+            continue;
+        }
+        if ( cp->checks & CLEANPATH_SAMEFILE ) {
+            int same = _cp_samefile( cp, &inodes, str, &stats->st[tok->st], cx );
+            if ( -1 == same ) {
+                bhash_free( &inodes );
+                bhash_free( &names );
+                errno = ENOMEM;
+                return -1;
+            }
+            if ( same ) {
+                tok->drop = 1;
+                continue;
+            }
+        }
+        if ( ( cp->checks & CLEANPATH_PRUNE )
+            && ( S_ISDIR( stats->st[tok->st].mode ) ) )
+        {
+            int gone = _cp_prune( cp, &names, str );
+            if ( -1 == gone ) {
+                bhash_free( &inodes );
+                bhash_free( &names );
+                errno = ENOMEM;
+                return -1;
+            }
+            if ( gone ) {
+                tok->drop = 1;
+                continue;
+            }
+        }
+        if ( cp->outlen ) {
+            cp->out[cp->outlen++] = cp->delimiter;
+        }
+        memcpy( cp->out + cp->outlen, str, tok->l );
+        cp->outlen += tok->l;
+        cp->count.tokens_out++;
+    }
+    cp->out[cp->outlen] = (char)0;
+    bhash_free( &inodes );
+    bhash_free( &names );
+    cp->count.check_ns += _cp_ns() - t0;
+    trace_span( "check", t0, NULL, 0, 0 );
+    if ( cp->work->memokey ) {
+        _cp_memo_put( cp, cp->work->memokey, cp->work->memokl,
+            cp->work->began );
+        free( cp->work->memokey );
+        cp->work->memokey = NULL;
+    }
+    return 0;
+}
+
+/****************************************************************************
+ * CLEANPATH_MEMO
+ */
+
+/* Everything the result depends on, but the filesystem */
+char *
+_cp_memo_key( struct cleanpath *cp, size_t *keylen )
+{
+    size_t  li = cp->input ? strlen( cp->input ) : 0;
+    size_t  le = cp->extra ? strlen( cp->extra ) : 0;
+    size_t  ls = 0;
+    const char * const *lx;
+    char   *key;
+    char   *cx;
+
+    /* Each minus and intersect list (and remove pattern) follows,
+     * after a NUL and m, i (or r) */
+    for ( lx = cp->minus; lx && *lx; lx++ ) {
+        ls += 2 + strlen( *lx );
+    }
+    for ( lx = cp->intersect; lx && *lx; lx++ ) {
+        ls += 2 + strlen( *lx );
+    }
+    for ( lx = cp->remove; lx && *lx; lx++ ) {
+        ls += 2 + strlen( *lx );
+    }
+    key = malloc( sizeof(int) + 2 + li + 1 + le + ls );
+    cx = key;
+    if ( !key ) {
+        return NULL;
+    }
+    memcpy( cx, &cp->checks, sizeof(int) );
+    cx += sizeof(int);
+    *cx++ = cp->delimiter;
+    *cx++ = cp->before ? 1 : 0;
+    if ( li ) {
+        memcpy( cx, cp->input, li );
+        cx += li;
+    }
+    *cx++ = (char)0;
+    if ( le ) {
+        memcpy( cx, cp->extra, le );
+        cx += le;
+    }
+    for ( lx = cp->minus; lx && *lx; lx++ ) {
+        *cx++ = (char)0;
+        *cx++ = 'm';
+        memcpy( cx, *lx, strlen( *lx ) );
+        cx += strlen( *lx );
+    }
+    for ( lx = cp->intersect; lx && *lx; lx++ ) {
+        *cx++ = (char)0;
+        *cx++ = 'i';
+        memcpy( cx, *lx, strlen( *lx ) );
+        cx += strlen( *lx );
+    }
+    for ( lx = cp->remove; lx && *lx; lx++ ) {
+        *cx++ = (char)0;
+        *cx++ = 'r';
+        memcpy( cx, *lx, strlen( *lx ) );
+        cx += strlen( *lx );
+    }
+    *keylen = cx - key;
+    return key;
+}
+
+/* Queue the directory path[0, len) to be a dependency, 0 or -1 */
+int
+_cp_memo_dep( bhash *deps, const char ***dirs, int *nd, int *ad,
+              const char *path, size_t len )
+{
+    bhent  *first;
+    char   *copy;
+    int     added;
+
+    if ( !len ) {
+        path = "/";
+        len  = 1;
+    }
+    if ( *nd == *ad ) {
+        const char **grow = realloc( *dirs, 2 * *ad * sizeof(char *) );
+        if ( !grow ) {
+            return -1;
+        }
+        *dirs = grow;
+        *ad *= 2;
+    }
+    copy = strndup( path, len );
+    if ( !copy ) {
+        return -1;
+    }
+    added = bhash_add( deps, copy, len, *nd, &first );
+    if ( 1 == added ) {
+        (*dirs)[(*nd)++] = copy;
+        return 0;
+    }
+    free( copy );
+    return added;
+}
+
+/* The directory path is in, by name, into deps */
+int
+_cp_memo_parent( bhash *deps, const char ***dirs, int *nd, int *ad,
+                 const char *path )
+{
+    size_t  len = strlen( path );
+    while ( ( 1 < len ) && ( '/' == path[len - 1] ) ) {
+        len--;
+    }
+    while ( ( len ) && ( '/' != path[len - 1] ) ) {
+        len--;
+    }
+    while ( ( 1 < len ) && ( '/' == path[len - 1] ) ) {
+        len--;
+    }
+    return _cp_memo_dep( deps, dirs, nd, ad, path, len );
+}
+
+/*
+ * Each link a symlink token goes through, by the directory holding it,
+ * into deps: repointing any of them changes that directory.  0, 1 if
+ * it dangles (or loops), -1 on allocation failure.
+ */
+int
+_cp_memo_links( bhash *deps, const char ***dirs, int *nd, int *ad,
+                const char *path )
+{
+    char    cur[PATH_MAX];
+    char    to[PATH_MAX];
+    struct stat st;
+    int     hop;
+
+    if ( strlen( path ) >= sizeof(cur) ) {
+        return 1;
+    }
+    strcpy( cur, path );
+    /* The same limit the kernel puts on a chain */
+    for ( hop = 0; hop < 40; hop++ ) {
+        ssize_t l;
+        size_t  dl;
+        if ( lstat( cur, &st ) ) {
+            /* A missing token is fine, its directory says if it shows
+             * up, a missing link target is not */
+            return ( 0 < hop );
+        }
+        if ( !S_ISLNK( st.st_mode ) ) {
+            return 0;
+        }
+        l = readlink( cur, to, sizeof(to) - 1 );
+        if ( 0 > l ) {
+            return 1;
+        }
+        to[l] = (char)0;
+        if ( '/' != *to ) {
+            /* Relative to the directory of the link */
+            dl = strrchr( cur, '/' ) - cur + 1;
+            if ( dl + l >= sizeof(cur) ) {
+                return 1;
+            }
+            memcpy( cur + dl, to, l + 1 );
+        }
+        else {
+            memcpy( cur, to, l + 1 );
+        }
+        if ( _cp_memo_parent( deps, dirs, nd, ad, cur ) ) {
+            return -1;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Store out, depending on the directory holding each token: a token
+ * can only appear, vanish or change type by an entry of that directory
+ * changing, which changes its ctime (or, if it is missing, by it being
+ * made).  A symlink token also depends on each link it goes through.
+ * Results with relative tokens (which depend on the working directory)
+ * or a dangling symlink are not kept at all.
+ */
+/*
+ * For queue(): 1 and out filled in on a hit, 0 on a miss (with the key
+ * kept for finish() to store under, if the memo applies at all), -1
+ * (ENOMEM).  The time is taken before any lookup of this run.
+ */
+int
+_cp_memo_get( struct cleanpath *cp )
+{
+    unsigned long long t0;
+    char   *out = NULL;
+    size_t  outlen = 0;
+    int     hit;
+
+    free( cp->work->memokey );
+    cp->work->memokey = NULL;
+    cp->work->memohit = 0;
+    cp->work->began   = time( NULL );
+    /* SAMEFILE and PRUNE depend on more than the parent directories */
+    if ( ( !( cp->checks & CLEANPATH_MEMO ) )
+        || ( cp->checks & ( CLEANPATH_SAMEFILE | CLEANPATH_PRUNE ) ) )
+    {
+        return 0;
+    }
+    t0 = _cp_ns();
+    cp->work->memokey = _cp_memo_key( cp, &cp->work->memokl );
+    if ( !cp->work->memokey ) {
+        errno = ENOMEM;
+        return -1;
+    }
+    hit = memo_get( cp->work->memokey, cp->work->memokl, &out, &outlen );
+    trace_span( "memo", t0, NULL, 0, hit );
+    if ( -1 == hit ) {
+        errno = ENOMEM;
+        return -1;
+    }
+    if ( !hit ) {
+        return 0;
+    }
+    if ( cp->debug ) {
+        fprintf( stderr, "memo: hit => \"%s\"\n", out );
+    }
+    free( cp->work->memokey );
+    cp->work->memokey = NULL;
+    cp->work->memohit = 1;
+    free( cp->out );
+    cp->out        = out;
+    cp->outlen     = outlen;
+    cp->work->outa = outlen + 1;
+    cp->count.memo++;
+    cp->count.check_ns += _cp_ns() - t0;
+    return 1;
+}
+
+void
+_cp_memo_put( struct cleanpath *cp, const char *key, size_t keylen,
+              time_t began )
+{
+    struct toklist *toks = &cp->work->toks;
+    const char **dirs = NULL;
+    bhash   deps;
+    int     nd = 0;
+    int     ad = 16;
+    int     cx;
+    int     ok = 1;
+
+    if ( bhash_init( &deps, 64 ) ) {
+        return;
+    }
+    dirs = malloc( ad * sizeof(char *) );
+    for ( cx = 0; ( ok ) && ( dirs ) && ( cx < toks->n ); cx++ ) {
+        const char *str = cp->work->whole + toks->t[cx].s;
+        if ( !( cp->checks & CP_LOOKUPS ) ) {
+            break;
+        }
+        if ( '/' != *str ) {
+            ok = 0;
+        }
+        else if ( _cp_memo_parent( &deps, &dirs, &nd, &ad, str ) ) {
+            ok = 0;
+        }
+        else if ( _cp_memo_links( &deps, &dirs, &nd, &ad, str ) ) {
+            ok = 0;
+        }
+    }
+    if ( ( ok ) && ( dirs ) ) {
+        if ( cp->debug ) {
+            fprintf( stderr, "memo: storing, %d directories\n", nd );
+        }
+        memo_put( key, keylen, dirs, nd, cp->out, cp->outlen, began );
+    }
+    else if ( cp->debug ) {
+        fprintf( stderr, "memo: not stored, a token is relative or"
+            " a dangling symlink\n" );
+    }
+    for ( cx = 0; cx < nd; cx++ ) {
+        free( (char *)dirs[cx] );
+    }
+    free( dirs );
+    bhash_free( &deps );
+    return;
+}
+
+int
+cleanpath_run( struct cleanpath *cp )
+{
+    int     ret;
+
+    ret = cleanpath_queue( cp );
+    if ( 0 == ret ) {
+        ret = cleanpath_finish( cp );
+    }
+    return ret;
+}
+
+/*
+ * Only the distinct tokens are kept (in the stats, for dedupe), never
+ * the input itself, so memory follows the number of distinct tokens.
+ */
+long
+cleanpath_feed( struct cleanpath *cp, char *buf, size_t len, int final )
+{
+    size_t  start = 0;
+    size_t  cx;
+    int     px;
+    cleanpath_work *w;
+    cleanpath_stats *stats;
+    unsigned long long t0 = _cp_ns();
+
+    if ( _cp_work( cp ) ) {
+        errno = ENOMEM;
+        return -1;
+    }
+    w = cp->work;
+    if ( ( !w->seen.e ) && bhash_init( &w->seen, 256 ) ) {
+        errno = ENOMEM;
+        return -1;
+    }
+    if ( ( cp->checks & CLEANPATH_SAMEFILE ) && ( !w->inodes.e )
+        && bhash_init( &w->inodes, 256 ) )
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    if ( ( cp->checks & CLEANPATH_PRUNE ) && ( !w->names.e )
+        && bhash_init( &w->names, 1024 ) )
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    stats = _cp_stats( cp );
+    /* minus and intersect are read by the first feed */
+    if ( ( !stats ) || ( ( !w->sets ) && _cp_sets( cp ) ) ) {
+        errno = ENOMEM;
+        return -1;
+    }
+    w->sets = 1;
+
+    if ( '\n' != cp->delimiter ) {
+        for ( cx = bscan_chr( buf, len, '\n' ); cx < len;
+              cx += 1 + bscan_chr( buf + cx + 1, len - cx - 1, '\n' ) )
+        {
+            buf[cx] = cp->delimiter;
+        }
+    }
+    w->np = 0;
+    while ( start < len ) {
+        size_t end = start + bscan_chr( buf + start, len - start,
+                                        cp->delimiter );
+        if ( ( end == len ) && ( !final ) ) {
+            /* The rest may be continued by the next feed */
+            break;
+        }
+        if ( end == start ) {
+            cp->count.empty++;
+        }
+        else {
+            char *tok = buf + start;
+            size_t l = end - start;
+            const char *key = tok;
+            size_t kl = l;
+            int drop;
+            cp->count.tokens_in++;
+            if ( cp->checks & CLEANPATH_NORMOUT ) {
+                l = bscan_path( tok, l );
+                cp->count.normalized += ( l < kl );
+                kl = l;
+            }
+            else if ( cp->checks & CLEANPATH_NORMALIZE ) {
+                if ( w->na < l ) {
+                    free( w->norm );
+                    w->na = 2 * l;
+                    w->norm = malloc( w->na );
+                    if ( !w->norm ) {
+                        w->na = 0;
+                        errno = ENOMEM;
+                        return -1;
+                    }
+                }
+                memcpy( w->norm, tok, l );
+                kl = bscan_path( w->norm, l );
+                cp->count.normalized += ( kl < l );
+                key = w->norm;
+            }
+            drop = _cp_filter( cp, tok, l );
+            if ( -1 == drop ) {
+                errno = ENOMEM;
+                return -1;
+            }
+            if ( drop ) {
+                /* Not seen, so a repeat is filtered again, not a dupe */
+                if ( cp->debug ) {
+                    fprintf( stderr, "%s token: [%.*s] (removing)\n",
+                        ( 2 == drop ) ? "removed" : "filtered", (int)l, tok );
+                }
+            }
+            else if ( !bhash_find( &w->seen, key, kl, bhash_sum( key, kl ) ) ) {
+                int sx = _cp_stats_add( stats, tok, l );
+                /* A normalized key needs a copy of its own to live in */
+                const char *keep = ( -1 == sx ) ? NULL
+                    : ( key == tok ) ? stats->paths[sx]
+                    : _cp_keep( stats, key, kl );
+                if ( ( !keep )
+                    || ( -1 == bhash_add( &w->seen, keep, kl, sx, NULL ) ) )
+                {
+                    errno = ENOMEM;
+                    return -1;
+                }
+                if ( w->np == w->pa ) {
+                    int *grow;
+                    int pa = w->pa ? ( 2 * w->pa ) : 256;
+                    grow = realloc( w->pend, pa * sizeof(int) );
+                    if ( !grow ) {
+                        errno = ENOMEM;
+                        return -1;
+                    }
+                    w->pend = grow;
+                    w->pa = pa;
+                }
+                w->pend[w->np++] = sx;
+            }
+            else {
+                cp->count.dupes++;
+                trace_mark( "duplicate", tok, l, -1 );
+                if ( cp->debug ) {
+                    fprintf( stderr, "duplicate token: [%.*s] (removing)\n",
+                        (int)l, tok );
+                }
+            }
+        }
+        start = end + 1;
+    }
+    cp->count.dedupe_ns += _cp_ns() - t0;
+    trace_span( "dedupe", t0, NULL, 0, 0 );
+
+    if ( cp->checks & CP_LOOKUPS ) {
+        _cp_stats_run( cp, stats );
+    }
+    t0 = _cp_ns();
+    for ( px = 0; px < w->np; px++ ) {
+        int sx = w->pend[px];
+        const char *str = stats->paths[sx];
+        size_t l = strlen( str );
+        if ( ( cp->checks & CP_LOOKUPS )
+            && _cp_token_check( cp, str, &stats->st[sx] ) )
+        {
+            cp->count.check_fail++;
+            continue;
+        }
+        if ( cp->checks & CLEANPATH_SAMEFILE ) {
+            int same = _cp_samefile( cp, &w->inodes, str, &stats->st[sx], sx );
+            if ( -1 == same ) {
+                errno = ENOMEM;
+                return -1;
+            }
+            if ( same ) {
+                continue;
+            }
+        }
+        if ( ( cp->checks & CLEANPATH_PRUNE )
+            && ( S_ISDIR( stats->st[sx].mode ) ) )
+        {
+            int gone = _cp_prune( cp, &w->names, str );
+            if ( -1 == gone ) {
+                errno = ENOMEM;
+                return -1;
+            }
+            if ( gone ) {
+                continue;
+            }
+        }
+        if ( _cp_outroom( cp, l + 1 ) ) {
+            errno = ENOMEM;
+            return -1;
+        }
+        if ( w->fed++ ) {
+            cp->out[cp->outlen++] = cp->delimiter;
+        }
+        memcpy( cp->out + cp->outlen, str, l );
+        cp->outlen += l;
+        cp->out[cp->outlen] = (char)0;
+        cp->count.tokens_out++;
+    }
+    cp->count.check_ns += _cp_ns() - t0;
+    trace_span( "check", t0, NULL, 0, 0 );
+    return (long)( ( start < len ) ? start : len );
+}
+
+int
+cleanpath_which( struct cleanpath *cp, const char *name, char *buf,
+                 size_t bufl )
+{
+    unsigned long long t0 = trace_ns();
+    int found = cindex_which( cp->out, cp->delimiter, name, cp->ttl,
+                    buf, bufl );
+    if ( cp->debug ) {
+        fprintf( stderr, "which(): %s => %s\n", name,
+            ( 1 == found ) ? buf : "(not found)" );
+    }
+    trace_span( "which", t0, name, strlen( name ), found );
+    return found;
+}
+
+const char *
+cleanpath_version()
+{
+    return LIBCLEANPATH_VERSION;
+}
@@ -0,0 +1,225 @@
+#define MEMO_VERSION "0.01"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "configure.h"
+
+#include "memo.h"
+
+#define MEMO_MAGIC      0x4d455043u     // "CPEM"
+#define MEMO_FORMAT     1
+#define MEMO_FILE       "cleanpath-memo"
+
+/* The head, the key, the directories, their names, then the result */
+struct memo_head {
+    uint32_t    magic;
+    uint32_t    format;
+    uint64_t    size;       // Whole file
+    uint32_t    keylen;
+    uint32_t    ndirs;
+    uint64_t    namelen;    // All of the directory names, each NUL ended
+    uint64_t    outlen;
+};
+
+struct memo_dir {
+    int64_t     ctime;      // -1 if it was missing
+    uint64_t    dev;
+    uint64_t    ino;
+    uint64_t    off;        // Of its name, after the directories
+};
+
+#define MEMO_DIRS(hd)   ( (const struct memo_dir *)( (const char *)(hd) \
+                            + sizeof(struct memo_head) \
+                            + ( ( (hd)->keylen + 7 ) & ~7 ) ) )
+#define MEMO_NAMES(hd)  ( (const char *)( MEMO_DIRS(hd) + (hd)->ndirs ) )
+#define MEMO_OUT(hd)    ( MEMO_NAMES(hd) + (hd)->namelen )
+
+/* $XDG_RUNTIME_DIR/cleanpath-memo.HASH, NULL if there is no such place */
+char *
+_memo_file( const char *key, size_t keylen )
+{
+    char *dir = getenv("XDG_RUNTIME_DIR");
+    char *file;
+    /* FNV-1a, 64 bit */
+    register uint64_t h = 14695981039346656037ull;
+    register const unsigned char *cx = (const unsigned char *)key;
+    register const unsigned char *end = cx + keylen;
+
+    if ( ( !dir ) || ( '/' != *dir ) ) {
+        return NULL;
+    }
+    for ( ; cx < end; cx++ ) {
+        h ^= *cx;
+        h *= 1099511628211ull;
+    }
+    file = malloc( strlen(dir) + strlen(MEMO_FILE) + 20 );
+    if ( file ) {
+        sprintf( file, "%s/%s.%016llx", dir, MEMO_FILE,
+            (unsigned long long)h );
+    }
+    return file;
+}
+
+/* 0 if dir is as it was when stored */
+int
+_memo_stale( const char *dir, const struct memo_dir *was )
+{
+    struct stat st;
+    if ( stat( dir, &st ) ) {
+        return ( -1 != was->ctime );
+    }
+    return ( ( was->ctime != st.st_ctime ) || ( was->dev != st.st_dev )
+        || ( was->ino != st.st_ino ) );
+}
+
+int
+memo_get( const char *key, size_t keylen, char **out, size_t *outlen )
+{
+    char   *file = _memo_file( key, keylen );
+    struct memo_head *hd;
+    struct stat st;
+    int     fd;
+    int     found = 0;
+    uint32_t dx;
+
+    if ( !file ) {
+        return 0;
+    }
+    fd = open( file, O_RDONLY | O_NOFOLLOW );
+    free( file );
+    if ( 0 > fd ) {
+        return 0;
+    }
+    /* Only ever trust a result this user stored */
+    if ( ( fstat( fd, &st ) ) || ( st.st_uid != getuid() )
+        || ( !S_ISREG( st.st_mode ) )
+        || ( sizeof(struct memo_head) > (size_t)st.st_size ) )
+    {
+        close( fd );
+        return 0;
+    }
+    hd = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+    close( fd );
+    if ( MAP_FAILED == (void *)hd ) {
+        return 0;
+    }
+    if ( ( MEMO_MAGIC != hd->magic ) || ( MEMO_FORMAT != hd->format )
+        || ( (uint64_t)st.st_size != hd->size ) || ( keylen != hd->keylen )
+        || ( (const char *)MEMO_OUT(hd) + hd->outlen
+                != (const char *)hd + hd->size )
+        || ( ( hd->namelen ) && ( MEMO_NAMES(hd)[hd->namelen - 1] ) )
+        || ( memcmp( hd + 1, key, keylen ) ) )
+    {
+        munmap( hd, st.st_size );
+        return 0;
+    }
+    for ( dx = 0; dx < hd->ndirs; dx++ ) {
+        const struct memo_dir *was = &MEMO_DIRS(hd)[dx];
+        if ( ( was->off >= hd->namelen )
+            || _memo_stale( MEMO_NAMES(hd) + was->off, was ) )
+        {
+            munmap( hd, st.st_size );
+            return 0;
+        }
+    }
+    *out = malloc( hd->outlen + 1 );
+    if ( *out ) {
+        memcpy( *out, MEMO_OUT(hd), hd->outlen );
+        (*out)[hd->outlen] = (char)0;
+        *outlen = hd->outlen;
+        found = 1;
+    }
+    else {
+        found = -1;
+    }
+    munmap( hd, st.st_size );
+    return found;
+}
+
+void
+memo_put( const char *key, size_t keylen, const char **dirs, int ndirs,
+          const char *out, size_t outlen, time_t began )
+{
+    char   *file = _memo_file( key, keylen );
+    char   *tmp = NULL;
+    char   *blk = NULL;
+    struct memo_head *hd;
+    struct memo_dir *md;
+    size_t  namelen = 0;
+    size_t  size;
+    size_t  off = 0;
+    int     fd;
+    int     dx;
+    int     bad;
+
+    if ( !file ) {
+        return;
+    }
+    for ( dx = 0; dx < ndirs; dx++ ) {
+        namelen += strlen( dirs[dx] ) + 1;
+    }
+    size = sizeof(struct memo_head) + ( ( keylen + 7 ) & ~(size_t)7 )
+         + ( ndirs * sizeof(struct memo_dir) ) + namelen + outlen;
+    blk = calloc( 1, size );
+    tmp = malloc( strlen( file ) + 32 );
+    if ( ( !blk ) || ( !tmp ) ) {
+        goto done;
+    }
+    hd = (struct memo_head *)blk;
+    hd->magic   = MEMO_MAGIC;
+    hd->format  = MEMO_FORMAT;
+    hd->size    = size;
+    hd->keylen  = keylen;
+    hd->ndirs   = ndirs;
+    hd->namelen = namelen;
+    hd->outlen  = outlen;
+    memcpy( hd + 1, key, keylen );
+    md = (struct memo_dir *)MEMO_DIRS(hd);
+    for ( dx = 0; dx < ndirs; dx++ ) {
+        struct stat st;
+        size_t l = strlen( dirs[dx] );
+        if ( stat( dirs[dx], &st ) ) {
+            md[dx].ctime = -1;
+        }
+        else if ( st.st_ctime >= began ) {
+            /* It changed since (or the second) the work began, maybe
+             * after it was looked at, and the ctime of a later change
+             * that second would not show it either */
+            goto done;
+        }
+        else {
+            md[dx].ctime = st.st_ctime;
+            md[dx].dev   = st.st_dev;
+            md[dx].ino   = st.st_ino;
+        }
+        md[dx].off = off;
+        memcpy( (char *)MEMO_NAMES(hd) + off, dirs[dx], l );
+        off += l + 1;
+    }
+    memcpy( (char *)MEMO_OUT(hd), out, outlen );
+
+    /* Written aside and renamed over, a reader only maps whole ones */
+    sprintf( tmp, "%s.%ld", file, (long)getpid() );
+    fd = open( tmp, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, 0600 );
+    if ( 0 > fd ) {
+        goto done;
+    }
+    bad = ( (ssize_t)size != write( fd, blk, size ) );
+    bad |= close( fd );
+    if ( bad || rename( tmp, file ) ) {
+        unlink( tmp );
+    }
+done:
+    free( blk );
+    free( tmp );
+    free( file );
+    return;
+}
@@ -0,0 +1,27 @@
+#ifndef VOLLINK_MEMO_H
+#define VOLLINK_MEMO_H
+
+#include <stddef.h>
+#include <time.h>
+
+/*
+ * Whole results, each in a file of its own under XDG_RUNTIME_DIR, named
+ * by a hash of its key (which is stored too, and compared in full).
+ * Each result depends on a list of directories: it is only handed back
+ * while every one still has the ctime, device and inode it had (or is
+ * still missing).  A directory whose ctime is not older than the
+ * second the work began (it may have changed after it was looked at)
+ * keeps the result from being stored at all.
+ */
+
+        // 1 and a malloc()ed copy of the result in *out, 0 if there is
+        // none (or it is stale), -1 on allocation failure
+int     memo_get( const char *key, size_t keylen, char **out,
+                  size_t *outlen );
+        // Store out for key, good as long as every dirs[] is unchanged.
+        // began is time() from before the first lookup out came from.
+void    memo_put( const char *key, size_t keylen, const char **dirs,
+                  int ndirs, const char *out, size_t outlen,
+                  time_t began );
+
+#endif
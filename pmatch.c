@@ -0,0 +1,359 @@
+#define PMATCH_VERSION "0.01"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include "configure.h"
+
+#include "pmatch.h"
+
+/* DFA states kept before starting over (make check also builds with
+ * a tiny one, to start over all the time), and the hash of them */
+#ifndef PMATCH_STATES
+#define PMATCH_STATES   2048
+#endif
+#define PMATCH_SLOTS    4096
+
+#define PM_ACCEPT   0   // The end of a pattern
+#define PM_SET      1   // One byte of set
+#define PM_STAR     2   // Any run of bytes
+
+/* One NFA state: what it takes to get past it */
+struct pm_nfa {
+    int     kind;
+    uint8_t set[32];
+};
+
+/* One DFA state, a set of NFA states */
+struct pm_state {
+    int     next[256];  // -1 until some string needs it
+    int     accept;     // A pattern ends here
+    int     sure;       // A pattern ends in *, every longer string matches
+    int     dead;       // No NFA state left, nothing will match
+};
+
+struct pmatch {
+    struct pm_nfa *nfa;
+    int     nn;         // NFA states
+    int     w;          // 64 bit words in a set of them
+    uint64_t *start;    // Each pattern's first state
+    struct pm_state *st;
+    uint64_t *bits;     // st[i]'s set is bits[i * w]
+    int     n;          // DFA states
+    int     a;
+    int     slot[PMATCH_SLOTS]; // DFA state by hash of its set, -1 empty
+    uint64_t *next;     // Scratch sets
+    uint64_t *keep;
+};
+
+#define PM_HAS(b, s)    ( (b)[(s) >> 6] & ( 1ull << ( (s) & 63 ) ) )
+#define PM_SETBIT(b, s) ( (b)[(s) >> 6] |= ( 1ull << ( (s) & 63 ) ) )
+#define PM_BYTE(set, c) ( (set)[(c) >> 3] & ( 1 << ( (c) & 7 ) ) )
+
+/* s, and past every * after it, since a * can match nothing */
+void
+_pm_close( pmatch *pm, uint64_t *bits, int s )
+{
+    PM_SETBIT( bits, s );
+    while ( PM_STAR == pm->nfa[s].kind ) {
+        s++;
+        PM_SETBIT( bits, s );
+    }
+    return;
+}
+
+/* The ] closing the class at cx, NULL if none (then [ is literal).  A ]
+ * right after the [ (or [!) is one of the class. */
+const unsigned char *
+_pm_class_end( const unsigned char *cx )
+{
+    cx++;
+    if ( ( '!' == *cx ) || ( '^' == *cx ) ) {
+        cx++;
+    }
+    if ( !*cx ) {
+        return NULL;
+    }
+    return (const unsigned char *)strchr( (const char *)cx + 1, ']' );
+}
+
+/*
+ * Each pattern into NFA states, one per byte (or class) and per run of
+ * *, then its accept state.  A prefix is its bytes then a *.  n is the
+ * state count, so the first pass only counts.
+ */
+int
+_pm_compile( pmatch *pm, const char *pat )
+{
+    const unsigned char *cx = (const unsigned char *)pat;
+    /* An empty pattern is not a prefix of everything, only matches "" */
+    int     glob = ( ( !*pat ) || ( NULL != strpbrk( pat, "*?[\\" ) ) );
+    int     n = 0;
+
+    while ( *cx ) {
+        struct pm_nfa *nf = pm->nfa ? &pm->nfa[pm->nn + n] : NULL;
+        if ( glob && ( '*' == *cx ) ) {
+            while ( '*' == *cx ) {
+                cx++;
+            }
+            if ( nf ) {
+                nf->kind = PM_STAR;
+            }
+            n++;
+            continue;
+        }
+        if ( nf ) {
+            nf->kind = PM_SET;
+            memset( nf->set, 0, sizeof(nf->set) );
+        }
+        if ( glob && ( '?' == *cx ) ) {
+            if ( nf ) {
+                memset( nf->set, 0xff, sizeof(nf->set) );
+            }
+            cx++;
+        }
+        else if ( glob && ( '[' == *cx ) && ( _pm_class_end( cx ) ) ) {
+            int not = ( ( '!' == cx[1] ) || ( '^' == cx[1] ) );
+            const unsigned char *end = _pm_class_end( cx );
+            int c;
+            for ( cx += 1 + not; cx < end; cx++ ) {
+                int lo = *cx;
+                int hi = *cx;
+                if ( ( '-' == cx[1] ) && ( cx + 2 < end ) ) {
+                    hi = cx[2];
+                    cx += 2;
+                }
+                for ( c = lo; ( nf ) && ( c <= hi ); c++ ) {
+                    nf->set[c >> 3] |= 1 << ( c & 7 );
+                }
+            }
+            cx = end + 1;
+            if ( ( nf ) && ( not ) ) {
+                for ( c = 0; c < 32; c++ ) {
+                    nf->set[c] = ~nf->set[c];
+                }
+            }
+        }
+        else {
+            if ( glob && ( '\\' == *cx ) && ( cx[1] ) ) {
+                cx++;
+            }
+            if ( nf ) {
+                nf->set[*cx >> 3] |= 1 << ( *cx & 7 );
+            }
+            cx++;
+        }
+        n++;
+    }
+    if ( !glob ) {
+        if ( pm->nfa ) {
+            pm->nfa[pm->nn + n].kind = PM_STAR;
+        }
+        n++;
+    }
+    if ( pm->nfa ) {
+        pm->nfa[pm->nn + n].kind = PM_ACCEPT;
+    }
+    return n + 1;
+}
+
+uint32_t
+_pm_hash( const pmatch *pm, const uint64_t *bits )
+{
+    /* FNV-1a over the words */
+    uint64_t h = 14695981039346656037ull;
+    int wx;
+    for ( wx = 0; wx < pm->w; wx++ ) {
+        h ^= bits[wx];
+        h *= 1099511628211ull;
+    }
+    return (uint32_t)( h ^ ( h >> 32 ) );
+}
+
+/* Start over with only the start state, when the DFA grows too big */
+void
+_pm_flush( pmatch *pm )
+{
+    memset( pm->slot, 0xff, sizeof(pm->slot) );
+    pm->n = 0;
+    return;
+}
+
+/* Index of the DFA state for the set bits, added if new, -1 ENOMEM */
+int
+_pm_state( pmatch *pm, const uint64_t *bits )
+{
+    uint32_t h = _pm_hash( pm, bits );
+    struct pm_state *st;
+    int     sx;
+    int     s;
+
+    for ( sx = h & ( PMATCH_SLOTS - 1 ); -1 != pm->slot[sx];
+          sx = ( sx + 1 ) & ( PMATCH_SLOTS - 1 ) )
+    {
+        if ( 0 == memcmp( &pm->bits[pm->slot[sx] * pm->w], bits,
+                          pm->w * sizeof(uint64_t) ) ) {
+            return pm->slot[sx];
+        }
+    }
+    if ( pm->n == pm->a ) {
+        int a = 2 * pm->a;
+        struct pm_state *grow = realloc( pm->st, a * sizeof(struct pm_state) );
+        if ( grow ) {
+            pm->st = grow;
+        }
+        uint64_t *bgrow = realloc( pm->bits, a * pm->w * sizeof(uint64_t) );
+        if ( bgrow ) {
+            pm->bits = bgrow;
+        }
+        if ( ( !grow ) || ( !bgrow ) ) {
+            errno = ENOMEM;
+            return -1;
+        }
+        pm->a = a;
+    }
+    st = &pm->st[pm->n];
+    memcpy( &pm->bits[pm->n * pm->w], bits, pm->w * sizeof(uint64_t) );
+    memset( st->next, 0xff, sizeof(st->next) );
+    st->accept = 0;
+    st->sure   = 0;
+    st->dead   = 1;
+    for ( s = 0; s < pm->nn; s++ ) {
+        if ( PM_HAS( bits, s ) ) {
+            st->dead = 0;
+            if ( PM_ACCEPT == pm->nfa[s].kind ) {
+                st->accept = 1;
+            }
+            else if ( ( PM_STAR == pm->nfa[s].kind )
+                && ( PM_ACCEPT == pm->nfa[s + 1].kind ) )
+            {
+                st->sure = 1;
+            }
+        }
+    }
+    pm->slot[sx] = pm->n;
+    return pm->n++;
+}
+
+pmatch *
+pmatch_new( const char * const *patterns, int n )
+{
+    pmatch *pm = calloc( 1, sizeof(pmatch) );
+    int     px;
+
+    if ( !pm ) {
+        return NULL;
+    }
+    for ( px = 0; px < n; px++ ) {
+        pm->nn += _pm_compile( pm, patterns[px] );
+    }
+    pm->w    = ( pm->nn / 64 ) + 1;
+    pm->a    = 64;
+    pm->nfa  = calloc( pm->nn + 1, sizeof(struct pm_nfa) );
+    pm->st   = malloc( pm->a * sizeof(struct pm_state) );
+    pm->bits = malloc( pm->a * pm->w * sizeof(uint64_t) );
+    pm->next = calloc( pm->w + 1, sizeof(uint64_t) );
+    pm->keep = calloc( pm->w + 1, sizeof(uint64_t) );
+    pm->start = calloc( pm->w + 1, sizeof(uint64_t) );
+    if ( ( !pm->nfa ) || ( !pm->st ) || ( !pm->bits ) || ( !pm->next )
+        || ( !pm->keep ) || ( !pm->start ) )
+    {
+        pmatch_free( pm );
+        return NULL;
+    }
+    pm->nn = 0;
+    for ( px = 0; px < n; px++ ) {
+        int base = pm->nn;
+        pm->nn += _pm_compile( pm, patterns[px] );
+        _pm_close( pm, pm->start, base );
+    }
+    _pm_flush( pm );
+    if ( 0 != _pm_state( pm, pm->start ) ) {
+        pmatch_free( pm );
+        return NULL;
+    }
+    return pm;
+}
+
+void
+pmatch_free( pmatch *pm )
+{
+    if ( !pm ) {
+        return;
+    }
+    free( pm->nfa );
+    free( pm->st );
+    free( pm->bits );
+    free( pm->next );
+    free( pm->keep );
+    free( pm->start );
+    free( pm );
+    return;
+}
+
+/* From DFA state cur on byte c, building that step if it is new */
+int
+_pm_step( pmatch *pm, int cur, int c )
+{
+    int     s;
+    int     to;
+
+    if ( PMATCH_STATES <= pm->n ) {
+        /* cur is renumbered by the flush, so it is kept aside */
+        memcpy( pm->keep, &pm->bits[cur * pm->w], pm->w * sizeof(uint64_t) );
+        _pm_flush( pm );
+        if ( ( 0 != _pm_state( pm, pm->start ) )
+            || ( -1 == ( cur = _pm_state( pm, pm->keep ) ) ) )
+        {
+            return -1;
+        }
+    }
+    memset( pm->next, 0, pm->w * sizeof(uint64_t) );
+    for ( s = 0; s < pm->nn; s++ ) {
+        const uint64_t *bits = &pm->bits[cur * pm->w];
+        if ( !PM_HAS( bits, s ) ) {
+            continue;
+        }
+        if ( PM_STAR == pm->nfa[s].kind ) {
+            _pm_close( pm, pm->next, s );
+        }
+        else if ( ( PM_SET == pm->nfa[s].kind )
+            && ( PM_BYTE( pm->nfa[s].set, c ) ) )
+        {
+            _pm_close( pm, pm->next, s + 1 );
+        }
+    }
+    to = _pm_state( pm, pm->next );
+    if ( -1 != to ) {
+        pm->st[cur].next[c] = to;
+    }
+    return to;
+}
+
+int
+pmatch_test( pmatch *pm, const char *str, size_t len )
+{
+    const unsigned char *cx = (const unsigned char *)str;
+    const unsigned char *end = cx + len;
+    int     cur = 0;
+
+    for ( ; cx < end; cx++ ) {
+        int to;
+        if ( pm->st[cur].sure ) {
+            return 1;
+        }
+        if ( pm->st[cur].dead ) {
+            return 0;
+        }
+        to = pm->st[cur].next[*cx];
+        if ( -1 == to ) {
+            to = _pm_step( pm, cur, *cx );
+            if ( -1 == to ) {
+                return -1;
+            }
+        }
+        cur = to;
+    }
+    return pm->st[cur].accept || pm->st[cur].sure;
+}
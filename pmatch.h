@@ -0,0 +1,24 @@
+#ifndef VOLLINK_PMATCH_H
+#define VOLLINK_PMATCH_H
+
+#include <stddef.h>
+
+/*
+ * Many patterns, compiled together, so testing a string against all of
+ * them is one step per byte however many there are.  A pattern with
+ * none of * ? [ \ is a prefix ("/mnt/stale/" matches "/mnt/stale/bin"),
+ * any other is a glob over the whole string: * is any run of bytes
+ * (including /), ? any one byte, [a-z] [!a-z] a class, \ quotes.
+ * An empty pattern only matches the empty string (so no token).
+ * The patterns become one NFA, which is run as a DFA built as strings
+ * need it (and thrown away, then rebuilt, if it ever grows too big).
+ */
+typedef struct pmatch pmatch;
+
+        // NULL (ENOMEM) on failure, patterns are not kept
+pmatch * pmatch_new( const char * const *patterns, int n );
+void    pmatch_free( pmatch *pm );
+        // 1 if str[0, len) matches any pattern, 0 if not, -1 (ENOMEM)
+int     pmatch_test( pmatch *pm, const char *str, size_t len );
+
+#endif
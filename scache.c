@@ -0,0 +1,283 @@
+#define SCACHE_VERSION "0.01"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "configure.h"
+
+#include "scache.h"
+
+#define SCACHE_MAGIC    0x43505343u     // "CPSC"
+#define SCACHE_FORMAT   2
+#define SCACHE_SLOTS    4096            // Power of two
+#define SCACHE_WAYS     4
+#define SCACHE_FILE     "cleanpath-stat.cache"
+#ifndef SCACHE_STUCK
+#define SCACHE_STUCK    2               // Seconds a claim is trusted
+#endif
+
+/* The low 32 bits of seq count, odd while a writer owns the slot, and
+ * the high 32 are the time() of that claim, so both are taken in one
+ * CAS and a second writer knows how long the first has had it (when is
+ * still the old entry's).  A reader copies the slot, then checks that
+ * seq is even and did not move while it copied.  A writer that dies
+ * leaves seq odd, the slot is taken over once its claim is SCACHE_STUCK
+ * old.  One that only stalled that long may still be storing after the
+ * new writer is done, sum is what catches that mix. */
+struct scache_slot {
+    uint64_t    seq;
+    uint64_t    key;    // Path hash
+    int64_t     when;   // time() of the stat()
+    uint32_t    plen;   // Path length, a cheap second check on key
+    int32_t     ret;
+    int32_t     err;
+    uint32_t    mode;
+    uint64_t    dev;
+    uint64_t    ino;
+    uint64_t    sum;    // Of all of the above but seq
+};
+
+struct scache_file {
+    uint32_t    magic;
+    uint32_t    format;
+    uint32_t    slots;
+    uint32_t    slotsize;
+    struct scache_slot slot[SCACHE_SLOTS];
+};
+
+struct {
+    struct scache_file *map;
+} scache;
+
+uint64_t
+_scache_key( const char *path, size_t len )
+{
+    /* FNV-1a, 64 bit */
+    register uint64_t h = 14695981039346656037ull;
+    register const unsigned char *cx = (const unsigned char *)path;
+    register const unsigned char *end = cx + len;
+    for ( ; cx < end; cx++ ) {
+        h ^= *cx;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+/* Check over one slot's fields, so a torn one is never taken as good */
+uint64_t
+_scache_sum( const struct scache_slot *slot )
+{
+    uint64_t f[7];
+    f[0] = slot->key;
+    f[1] = (uint64_t)slot->when;
+    f[2] = ( (uint64_t)slot->plen << 32 ) | slot->mode;
+    f[3] = ( (uint64_t)(uint32_t)slot->ret << 32 ) | (uint32_t)slot->err;
+    f[4] = slot->dev;
+    f[5] = slot->ino;
+    f[6] = SCACHE_MAGIC;
+    return _scache_key( (const char *)f, sizeof(f) );
+}
+
+int
+scache_open()
+{
+    char *dir = getenv("XDG_RUNTIME_DIR");
+    char *file;
+    struct stat statbuf;
+    struct scache_file *map;
+    struct scache_file *none = NULL;
+    int fd;
+
+    if ( __atomic_load_n( &scache.map, __ATOMIC_ACQUIRE ) ) {
+        return 0;
+    }
+    if ( ( !dir ) || ( '/' != *dir ) ) {
+        return -1;
+    }
+    file = malloc( strlen(dir) + 1 + strlen(SCACHE_FILE) + 1 );
+    if ( !file ) {
+        return -1;
+    }
+    sprintf( file, "%s/%s", dir, SCACHE_FILE );
+    fd = open( file, O_RDWR | O_CREAT | O_NOFOLLOW, 0600 );
+    free( file );
+    if ( 0 > fd ) {
+        return -1;
+    }
+    /* Only ever trust a cache this user made */
+    if ( ( fstat( fd, &statbuf ) )
+        || ( statbuf.st_uid != getuid() )
+        || ( S_IFREG != ( statbuf.st_mode & S_IFMT ) ) )
+    {
+        close( fd );
+        return -1;
+    }
+    if ( statbuf.st_size < sizeof(struct scache_file) ) {
+        /* New, or truncated, whoever gets here first zero-fills it,
+         * and a second ftruncate() to the same size changes nothing. */
+        if ( ftruncate( fd, sizeof(struct scache_file) ) ) {
+            close( fd );
+            return -1;
+        }
+    }
+    map = mmap( NULL, sizeof(struct scache_file),
+                PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    close( fd );
+    if ( MAP_FAILED == (void *)map ) {
+        return -1;
+    }
+    if ( 0 == __atomic_load_n( &map->magic, __ATOMIC_ACQUIRE ) ) {
+        map->format   = SCACHE_FORMAT;
+        map->slots    = SCACHE_SLOTS;
+        map->slotsize = sizeof(struct scache_slot);
+        __atomic_store_n( &map->magic, SCACHE_MAGIC, __ATOMIC_RELEASE );
+    }
+    if ( ( SCACHE_MAGIC  != map->magic )
+        || ( SCACHE_FORMAT != map->format )
+        || ( SCACHE_SLOTS  != map->slots )
+        || ( sizeof(struct scache_slot) != map->slotsize ) )
+    {
+        /* Some other version of cleanpath owns this file */
+        munmap( map, sizeof(struct scache_file) );
+        return -1;
+    }
+    /* Another thread may have opened it meanwhile, keep only one */
+    if ( !__atomic_compare_exchange_n( &scache.map, &none, map, 0,
+            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE ) )
+    {
+        munmap( map, sizeof(struct scache_file) );
+    }
+    return 0;
+}
+
+void
+scache_close()
+{
+    if ( scache.map ) {
+        munmap( scache.map, sizeof(struct scache_file) );
+    }
+    scache.map = NULL;
+    return;
+}
+
+int
+scache_get( const char *path, struct tstat *ts, int ttl )
+{
+    size_t   plen = strlen(path);
+    uint64_t key  = _scache_key( path, plen );
+    int64_t  now  = time(NULL);
+    int      way;
+
+    if ( ( !scache.map ) || ( '/' != *path ) ) {
+        return 0;
+    }
+    for ( way = 0; way < SCACHE_WAYS; way++ ) {
+        struct scache_slot *slot =
+            &scache.map->slot[ ( key + way ) & ( SCACHE_SLOTS - 1 ) ];
+        struct scache_slot copy;
+        uint64_t seq = __atomic_load_n( &slot->seq, __ATOMIC_ACQUIRE );
+        if ( seq & 1 ) {
+            continue;
+        }
+        memcpy( &copy, slot, sizeof(copy) );
+        __atomic_thread_fence( __ATOMIC_ACQUIRE );
+        if ( seq != __atomic_load_n( &slot->seq, __ATOMIC_RELAXED ) ) {
+            continue;
+        }
+        if ( ( copy.key != key ) || ( copy.plen != plen )
+            || ( copy.sum != _scache_sum( &copy ) ) )
+        {
+            continue;
+        }
+        if ( ( copy.when > now ) || ( ( now - copy.when ) >= ttl ) ) {
+            return 0;
+        }
+        ts->ret  = copy.ret;
+        ts->err  = copy.err;
+        ts->mode = copy.mode;
+        ts->dev  = copy.dev;
+        ts->ino  = copy.ino;
+        return 1;
+    }
+    return 0;
+}
+
+void
+scache_put( const char *path, const struct tstat *ts )
+{
+    size_t   plen = strlen(path);
+    uint64_t key  = _scache_key( path, plen );
+    int64_t  now  = time(NULL);
+    struct scache_slot *slot = NULL;
+    struct scache_slot fill;
+    uint64_t seq;
+    uint64_t own;
+    int      way;
+
+    if ( ( !scache.map ) || ( '/' != *path ) ) {
+        return;
+    }
+    /* sum is of what this writer means to store, not of what the slot
+     * ends up with */
+    memset( &fill, 0, sizeof(fill) );
+    fill.key  = key;
+    fill.plen = plen;
+    fill.when = now;
+    fill.ret  = ts->ret;
+    fill.err  = ts->err;
+    fill.mode = ts->mode;
+    fill.dev  = ts->dev;
+    fill.ino  = ts->ino;
+    fill.sum  = _scache_sum( &fill );
+    /* The slot that already has this path, or else the oldest */
+    for ( way = 0; way < SCACHE_WAYS; way++ ) {
+        struct scache_slot *try =
+            &scache.map->slot[ ( key + way ) & ( SCACHE_SLOTS - 1 ) ];
+        if ( ( try->key == key ) && ( try->plen == plen ) ) {
+            slot = try;
+            break;
+        }
+        if ( ( !slot ) || ( try->when < slot->when ) ) {
+            slot = try;
+        }
+    }
+    seq = __atomic_load_n( &slot->seq, __ATOMIC_RELAXED );
+    own = ( (uint64_t)(uint32_t)now << 32 ) | (uint32_t)( seq + 1 );
+    if ( seq & 1 ) {
+        /* Someone else is writing it, theirs is as good as ours, unless
+         * they claimed it so long ago they must have died */
+        int32_t age = (int32_t)( (uint32_t)now - (uint32_t)( seq >> 32 ) );
+        if ( age < SCACHE_STUCK ) {
+            return;
+        }
+        /* Still odd, but ours */
+        own = ( (uint64_t)(uint32_t)now << 32 ) | (uint32_t)( seq + 2 );
+    }
+    if ( !__atomic_compare_exchange_n( &slot->seq, &seq, own, 0,
+            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED ) )
+    {
+        return;
+    }
+    /* The odd seq has to be seen before any of the new fields are */
+    __atomic_thread_fence( __ATOMIC_RELEASE );
+    slot->key  = fill.key;
+    slot->plen = fill.plen;
+    slot->when = fill.when;
+    slot->ret  = fill.ret;
+    slot->err  = fill.err;
+    slot->mode = fill.mode;
+    slot->dev  = fill.dev;
+    slot->ino  = fill.ino;
+    slot->sum  = fill.sum;
+    /* Unless it was taken over meanwhile, then it is not ours to end */
+    __atomic_compare_exchange_n( &slot->seq, &own, own + 1, 0,
+        __ATOMIC_RELEASE, __ATOMIC_RELAXED );
+    return;
+}
@@ -0,0 +1,24 @@
+#ifndef VOLLINK_SCACHE_H
+#define VOLLINK_SCACHE_H
+
+#include "tstat.h"
+
+/*
+ * stat() results shared by every cleanpath run by the same user, in a
+ * memory-mapped file under XDG_RUNTIME_DIR.  Readers take no locks,
+ * each slot is a seqlock.
+ */
+
+        // 0 if the cache is usable, -1 if not (no XDG_RUNTIME_DIR, etc)
+        // Safe to call from any thread, the file is mapped just once
+int     scache_open();
+        // 1 and *ts filled in if path was stored less than ttl seconds ago
+        // A relative path is never stored, it means another file from
+        // another working directory
+int     scache_get( const char *path, struct tstat *ts, int ttl );
+        // A slot left mid-write (its writer died) is taken over a few
+        // seconds after it was claimed
+void    scache_put( const char *path, const struct tstat *ts );
+void    scache_close();
+
+#endif
@@ -0,0 +1,208 @@
+#define SHARD_VERSION "0.01"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include "configure.h"
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "bhash.h"
+#include "shard.h"
+
+/* Shared by the jobs of one shard_first(), each only writes its own
+ * parts of it.  There are as many shards as jobs. */
+struct shard_work {
+    const char *base;
+    const struct shard_key *keys;
+    int     n;
+    int     jobs;
+    int     w;          // Row of at[], jobs padded to a cache line
+    int *   first;
+    uint32_t *h;        // bhash_sum() of each key
+    int *   order;      // Key indexes by shard, in list order in each
+    int *   at;         // [job * w + shard]: how many keys of its slice
+                        // the shard has, then where the next one goes
+    int *   start;      // Where each shard begins in order, [jobs] is n
+    int     fail;
+};
+
+struct shard_job {
+    struct shard_work *sw;
+    int     jx;
+    void    (*fn)( struct shard_work *sw, int jx );
+#ifdef HAVE_PTHREAD
+    pthread_t tid;
+    int     up;
+#endif
+};
+
+/* By the high bits of the hash, bhash slots go by the low ones */
+#define SHARD_OF(h, jobs)   ( (int)( ( (uint64_t)(h) * (jobs) ) >> 32 ) )
+/* Where job jx's slice of the list begins */
+#define SHARD_LO(sw, jx)    ( (int)( ( (int64_t)(sw)->n * (jx) ) \
+                                / (sw)->jobs ) )
+
+/* Hash each key of slice jx, and count them by shard */
+void
+_shard_hash( struct shard_work *sw, int jx )
+{
+    int    *count = &sw->at[jx * sw->w];
+    int     hi = SHARD_LO( sw, jx + 1 );
+    int     cx;
+    for ( cx = SHARD_LO( sw, jx ); cx < hi; cx++ ) {
+        sw->h[cx] = bhash_sum( sw->base + sw->keys[cx].s, sw->keys[cx].l );
+        count[SHARD_OF( sw->h[cx], sw->jobs )]++;
+    }
+    return;
+}
+
+/* Put each key of slice jx in its shard's part of order */
+void
+_shard_scatter( struct shard_work *sw, int jx )
+{
+    int    *at = &sw->at[jx * sw->w];
+    int     hi = SHARD_LO( sw, jx + 1 );
+    int     cx;
+    for ( cx = SHARD_LO( sw, jx ); cx < hi; cx++ ) {
+        sw->order[at[SHARD_OF( sw->h[cx], sw->jobs )]++] = cx;
+    }
+    return;
+}
+
+/* Shard jx in list order, so the first of each key in it is the first
+ * in the list */
+void
+_shard_dedupe( struct shard_work *sw, int jx )
+{
+    bhash   seen;
+    bhent  *ent;
+    int     ox;
+
+    if ( bhash_init( &seen, sw->start[jx + 1] - sw->start[jx] ) ) {
+        __sync_fetch_and_or( &sw->fail, 1 );
+        return;
+    }
+    for ( ox = sw->start[jx]; ox < sw->start[jx + 1]; ox++ ) {
+        int cx = sw->order[ox];
+        if ( -1 == bhash_put( &seen, sw->base + sw->keys[cx].s,
+                              sw->keys[cx].l, sw->h[cx], cx, &ent ) )
+        {
+            __sync_fetch_and_or( &sw->fail, 1 );
+            break;
+        }
+        sw->first[cx] = ent->v;
+    }
+    bhash_free( &seen );
+    return;
+}
+
+#ifdef HAVE_PTHREAD
+void *
+_shard_thread( void *arg )
+{
+    struct shard_job *job = arg;
+    job->fn( job->sw, job->jx );
+    return NULL;
+}
+#endif
+
+/* fn for every job, this thread is job 0 (and any that could not get
+ * a thread of their own), returns when all are done */
+void
+_shard_each( struct shard_job *job, void (*fn)( struct shard_work *, int ) )
+{
+    struct shard_work *sw = job[0].sw;
+    int     jx;
+
+#ifdef HAVE_PTHREAD
+    for ( jx = 1; jx < sw->jobs; jx++ ) {
+        job[jx].fn = fn;
+        job[jx].up = ( 0 == pthread_create( &job[jx].tid, NULL,
+                                            _shard_thread, &job[jx] ) );
+    }
+#endif
+    fn( sw, 0 );
+    for ( jx = 1; jx < sw->jobs; jx++ ) {
+#ifdef HAVE_PTHREAD
+        if ( job[jx].up ) {
+            pthread_join( job[jx].tid, NULL );
+            continue;
+        }
+#endif
+        fn( sw, jx );
+    }
+    return;
+}
+
+int
+shard_first( const char *base, const struct shard_key *keys, int n,
+             int jobs, int *first )
+{
+    struct shard_work sw;
+    struct shard_job *job;
+    int     sx;
+    int     jx;
+    int     at = 0;
+
+#ifndef HAVE_PTHREAD
+    jobs = 1;
+#endif
+    if ( jobs > n ) {
+        jobs = n;
+    }
+    if ( 1 > jobs ) {
+        jobs = 1;
+    }
+    memset( &sw, 0, sizeof(sw) );
+    sw.base  = base;
+    sw.keys  = keys;
+    sw.n     = n;
+    sw.jobs  = jobs;
+    sw.w     = ( jobs + 15 ) & ~15;
+    sw.first = first;
+    sw.h     = malloc( ( n + 1 ) * sizeof(uint32_t) );
+    sw.order = malloc( ( n + 1 ) * sizeof(int) );
+    sw.at    = calloc( jobs * sw.w, sizeof(int) );
+    sw.start = malloc( ( jobs + 1 ) * sizeof(int) );
+    job      = calloc( jobs, sizeof(struct shard_job) );
+    if ( ( !sw.h ) || ( !sw.order ) || ( !sw.at ) || ( !sw.start )
+        || ( !job ) )
+    {
+        sw.fail = 1;
+        goto done;
+    }
+    for ( jx = 0; jx < jobs; jx++ ) {
+        job[jx].sw = &sw;
+        job[jx].jx = jx;
+    }
+
+    _shard_each( job, _shard_hash );
+    /* Shard by shard, and in each the slices in order, so each shard
+     * gets its keys in list order */
+    for ( sx = 0; sx < jobs; sx++ ) {
+        sw.start[sx] = at;
+        for ( jx = 0; jx < jobs; jx++ ) {
+            int count = sw.at[jx * sw.w + sx];
+            sw.at[jx * sw.w + sx] = at;
+            at += count;
+        }
+    }
+    sw.start[jobs] = at;
+    _shard_each( job, _shard_scatter );
+    _shard_each( job, _shard_dedupe );
+
+done:
+    free( sw.h );
+    free( sw.order );
+    free( sw.at );
+    free( sw.start );
+    free( job );
+    if ( sw.fail ) {
+        errno = ENOMEM;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,24 @@
+#ifndef VOLLINK_SHARD_H
+#define VOLLINK_SHARD_H
+
+/*
+ * Dedupe of a long list spread over threads.  Each key goes to the
+ * shard its hash picks, so every copy of a key lands in the same one,
+ * and each shard is filled in list order by its own thread with its
+ * own set.  The first copy a shard sees is then the first in the list,
+ * so the answer is exactly what one pass in order would give.
+ */
+
+/* One key, at base + s in shard_first()'s base */
+struct shard_key {
+    int     s;      // Offset
+    int     l;      // Length
+};
+
+        // first[i] is the index of the first of keys[0..n) equal to
+        // keys[i], i itself if there is none ahead of it, over jobs
+        // threads (serial without pthreads).  0, or -1 (ENOMEM)
+int     shard_first( const char *base, const struct shard_key *keys, int n,
+                     int jobs, int *first );
+
+#endif
@@ -0,0 +1,212 @@
+#define TRACE_VERSION "0.01"
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include "configure.h"
+
+#include "trace.h"
+
+#define TRACE_DETAIL 112    // Bytes of a token kept, most paths fit
+
+struct trace_ev {
+    const char *name;
+    unsigned long long ts;
+    unsigned long long dur;
+    int     tid;
+    int     code;
+    char    ph;     // 'X' span, 'i' instant
+    char    cut;    // detail was longer than this
+    unsigned char dlen;
+    char    detail[TRACE_DETAIL];
+};
+
+struct {
+    struct trace_ev *ev;
+    size_t  cap;
+    unsigned long next; // Events ever taken, claimed with an atomic add
+    int     tids;
+} trace;
+
+/* Small thread numbers, in the order threads first trace something */
+__thread int _trace_tid;
+
+unsigned long long
+trace_ns()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ( (unsigned long long)ts.tv_sec * 1000000000ULL ) + ts.tv_nsec;
+}
+
+int
+trace_open( size_t events )
+{
+    trace_close();
+    if ( !events ) {
+        events = 1;
+    }
+    /* Pages are only touched as the ring fills, so a big one is cheap */
+    trace.ev = malloc( events * sizeof(struct trace_ev) );
+    if ( !trace.ev ) {
+        return -1;
+    }
+    trace.cap  = events;
+    trace.next = 0;
+    return 0;
+}
+
+int
+trace_on()
+{
+    return ( NULL != trace.ev );
+}
+
+void
+trace_close()
+{
+    free( trace.ev );
+    trace.ev   = NULL;
+    trace.cap  = 0;
+    trace.next = 0;
+    return;
+}
+
+void
+_trace_add( const char *name, char ph, unsigned long long ts,
+            unsigned long long dur, const char *detail, size_t dlen,
+            int code )
+{
+    struct trace_ev *ev;
+    unsigned long at;
+
+    if ( !trace.ev ) {
+        return;
+    }
+    if ( !_trace_tid ) {
+        _trace_tid = __sync_add_and_fetch( &trace.tids, 1 );
+    }
+    at = __sync_fetch_and_add( &trace.next, 1 );
+    ev = &trace.ev[at % trace.cap];
+    ev->name = name;
+    ev->ph   = ph;
+    ev->ts   = ts;
+    ev->dur  = dur;
+    ev->tid  = _trace_tid;
+    ev->code = code;
+    ev->cut  = 0;
+    if ( !detail ) {
+        dlen = 0;
+    }
+    if ( dlen > TRACE_DETAIL ) {
+        dlen = TRACE_DETAIL;
+        ev->cut = 1;
+    }
+    if ( dlen ) {
+        memcpy( ev->detail, detail, dlen );
+    }
+    ev->dlen = (unsigned char)dlen;
+    return;
+}
+
+void
+trace_span( const char *name, unsigned long long start,
+            const char *detail, size_t dlen, int code )
+{
+    unsigned long long now;
+    if ( !trace.ev ) {
+        return;
+    }
+    now = trace_ns();
+    _trace_add( name, 'X', start, now - start, detail, dlen, code );
+    return;
+}
+
+void
+trace_mark( const char *name, const char *detail, size_t dlen, int code )
+{
+    if ( !trace.ev ) {
+        return;
+    }
+    _trace_add( name, 'i', trace_ns(), 0, detail, dlen, code );
+    return;
+}
+
+/* A JSON string, without the quotes */
+void
+_trace_json( FILE *fh, const char *s, size_t l )
+{
+    size_t cx;
+    for ( cx = 0; cx < l; cx++ ) {
+        unsigned char c = (unsigned char)s[cx];
+        if ( ( '"' == c ) || ( '\\' == c ) ) {
+            fputc( '\\', fh );
+            fputc( c, fh );
+        }
+        else if ( 0x20 > c ) {
+            fprintf( fh, "\\u%04x", c );
+        }
+        else {
+            fputc( c, fh );
+        }
+    }
+    return;
+}
+
+int
+trace_write( const char *file )
+{
+    FILE *fh;
+    unsigned long first = 0;
+    unsigned long cx;
+    int bad;
+
+    if ( !trace.ev ) {
+        errno = EINVAL;
+        return -1;
+    }
+    fh = fopen( file, "w" );
+    if ( !fh ) {
+        return -1;
+    }
+    if ( trace.next > trace.cap ) {
+        first = trace.next - trace.cap;
+    }
+    fprintf( fh, "{\"traceEvents\":[\n" );
+    fprintf( fh, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+        "\"tid\":1,\"args\":{\"name\":\"cleanpath\"}}" );
+    for ( cx = first; cx < trace.next; cx++ ) {
+        struct trace_ev *ev = &trace.ev[cx % trace.cap];
+        /* ts and dur are in microseconds */
+        fprintf( fh, ",\n{\"name\":\"%s\",\"cat\":\"cleanpath\","
+            "\"ph\":\"%c\",\"ts\":%llu.%03llu,", ev->name, ev->ph,
+            ev->ts / 1000, ev->ts % 1000 );
+        if ( 'X' == ev->ph ) {
+            fprintf( fh, "\"dur\":%llu.%03llu,", ev->dur / 1000,
+                ev->dur % 1000 );
+        }
+        else {
+            fprintf( fh, "\"s\":\"t\"," );
+        }
+        fprintf( fh, "\"pid\":1,\"tid\":%d,\"args\":{\"code\":%d",
+            ev->tid, ev->code );
+        if ( ev->dlen ) {
+            fprintf( fh, ",\"token\":\"" );
+            _trace_json( fh, ev->detail, ev->dlen );
+            fprintf( fh, "%s\"", ev->cut ? "..." : "" );
+        }
+        fprintf( fh, "}}" );
+    }
+    fprintf( fh, "\n],\"displayTimeUnit\":\"ns\","
+        "\"otherData\":{\"events\":%lu,\"dropped\":%lu}}\n",
+        trace.next - first, first );
+    bad = ferror( fh );
+    if ( fclose( fh ) || bad ) {
+        if ( !errno ) {
+            errno = EIO;
+        }
+        return -1;
+    }
+    return 0;
+}
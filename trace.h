@@ -0,0 +1,40 @@
+#ifndef VOLLINK_TRACE_H
+#define VOLLINK_TRACE_H
+
+#include <stddef.h>
+
+/*
+ * Trace events, written out as Chrome / Perfetto trace-event JSON.
+ * Events go into a ring allocated by trace_open(), so taking one is a
+ * clock read and a short copy, nothing is written until trace_write().
+ * When the ring fills, the oldest events are overwritten.  One trace
+ * per process, safe from any thread.
+ *
+ * Each event may have a detail (a token, copied, maybe cut short) and
+ * has a code, which means what the name says:
+ *     stat, statx     errno, 0 if it exists
+ *     cached          errno, from the shared cache (scache.h)
+ *     token_check     0 kept, 1 not a directory, 2 not a file,
+ *                     3 neither, 7 does not exist
+ *     duplicate       index of the token it repeats, -1 if not known
+ *     split, lookups  how many tokens
+ */
+
+        // Room for events, 0 or -1 (ENOMEM).  Again resets the trace.
+int     trace_open( size_t events );
+        // Non-zero after trace_open()
+int     trace_on();
+        // CLOCK_MONOTONIC ns, the clock every event uses
+unsigned long long trace_ns();
+        // From start to now.  name is kept as a pointer (a string
+        // constant), detail may be NULL.
+void    trace_span( const char *name, unsigned long long start,
+                    const char *detail, size_t dlen, int code );
+        // At this moment, no duration
+void    trace_mark( const char *name, const char *detail, size_t dlen,
+                    int code );
+        // The ring, oldest first, to file.  0 or -1 with errno set.
+int     trace_write( const char *file );
+void    trace_close();
+
+#endif
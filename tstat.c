@@ -0,0 +1,368 @@
+#define TSTAT_VERSION "0.01"
+#ifdef __linux__
+/* struct statx, for the io_uring backend */
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "configure.h"
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#ifdef HAVE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <linux/io_uring.h>
+#endif
+
+#include "tstat.h"
+#include "scache.h"
+#include "trace.h"
+
+/* Each worker takes the next unclaimed path until none are left, so a
+ * slow (NFS, autofs) path only holds up the one worker that drew it. */
+struct tstat_work {
+    const char **   paths;
+    struct tstat *  out;
+    int             n;
+    int             next;
+};
+
+int
+tstat_one( const char *path, struct tstat *ts )
+{
+    struct stat statbuf;
+    unsigned long long t0 = trace_on() ? trace_ns() : 0;
+    memset( ts, 0, sizeof(struct tstat) );
+    ts->ret = stat( path, &statbuf );
+    if ( -1 == ts->ret ) {
+        ts->err = errno;
+    }
+    else {
+        ts->mode = statbuf.st_mode;
+        ts->dev  = statbuf.st_dev;
+        ts->ino  = statbuf.st_ino;
+    }
+    if ( t0 ) {
+        trace_span( "stat", t0, path, strlen( path ), ts->err );
+    }
+    return ts->ret;
+}
+
+int
+tstat_command( int dfd, const char *name, int type )
+{
+    struct stat st;
+    if ( DT_REG != type ) {
+        /* A symlink, or a filesystem that does not say */
+        if ( fstatat( dfd, name, &st, 0 ) || ( !S_ISREG( st.st_mode ) ) ) {
+            return 0;
+        }
+    }
+    return ( 0 == faccessat( dfd, name, X_OK, AT_EACCESS ) );
+}
+
+#ifdef HAVE_PTHREAD
+void *
+_tstat_worker( void *arg )
+{
+    struct tstat_work *work = arg;
+    int cx;
+    while ( ( cx = __sync_fetch_and_add( &work->next, 1 ) ) < work->n ) {
+        tstat_one( work->paths[cx], &work->out[cx] );
+    }
+    return NULL;
+}
+#endif
+
+#ifdef HAVE_IO_URING
+/*
+ * One IORING_OP_STATX per path, submitted TSTAT_RING at a time, so the
+ * whole list costs a few io_uring_enter() calls instead of a stat()
+ * each.  There is no liburing here, just the raw rings.
+ * Returns -1 (and nothing is filled in) if io_uring can't be set up.
+ */
+#define TSTAT_RING 256
+
+struct tstat_ring {
+    int             fd;
+    void *          sq_ptr;
+    size_t          sq_len;
+    void *          cq_ptr;
+    size_t          cq_len;
+    struct io_uring_sqe *sqes;
+    size_t          sqes_len;
+    unsigned *      sq_tail;
+    unsigned *      sq_mask;
+    unsigned *      sq_array;
+    unsigned *      cq_head;
+    unsigned *      cq_tail;
+    unsigned *      cq_mask;
+    struct io_uring_cqe *cqes;
+};
+
+void
+_tstat_ring_close( struct tstat_ring *ring )
+{
+    if ( ring->sqes && ( MAP_FAILED != (void *)ring->sqes ) ) {
+        munmap( ring->sqes, ring->sqes_len );
+    }
+    if ( ring->cq_ptr && ( ring->cq_ptr != ring->sq_ptr )
+        && ( MAP_FAILED != ring->cq_ptr ) )
+    {
+        munmap( ring->cq_ptr, ring->cq_len );
+    }
+    if ( ring->sq_ptr && ( MAP_FAILED != ring->sq_ptr ) ) {
+        munmap( ring->sq_ptr, ring->sq_len );
+    }
+    if ( 0 <= ring->fd ) {
+        close( ring->fd );
+    }
+    return;
+}
+
+int
+_tstat_ring_open( struct tstat_ring *ring, unsigned entries )
+{
+    struct io_uring_params p;
+
+    memset( ring, 0, sizeof(struct tstat_ring) );
+    memset( &p, 0, sizeof(p) );
+    ring->fd = syscall( __NR_io_uring_setup, entries, &p );
+    if ( 0 > ring->fd ) {
+        return -1;
+    }
+    ring->sq_len = p.sq_off.array + ( p.sq_entries * sizeof(unsigned) );
+    ring->cq_len = p.cq_off.cqes
+                 + ( p.cq_entries * sizeof(struct io_uring_cqe) );
+    if ( p.features & IORING_FEAT_SINGLE_MMAP ) {
+        if ( ring->cq_len > ring->sq_len ) {
+            ring->sq_len = ring->cq_len;
+        }
+        ring->cq_len = ring->sq_len;
+    }
+    ring->sq_ptr = mmap( NULL, ring->sq_len, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING );
+    if ( MAP_FAILED == ring->sq_ptr ) {
+        _tstat_ring_close( ring );
+        return -1;
+    }
+    if ( p.features & IORING_FEAT_SINGLE_MMAP ) {
+        ring->cq_ptr = ring->sq_ptr;
+    }
+    else {
+        ring->cq_ptr = mmap( NULL, ring->cq_len, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd,
+                        IORING_OFF_CQ_RING );
+        if ( MAP_FAILED == ring->cq_ptr ) {
+            _tstat_ring_close( ring );
+            return -1;
+        }
+    }
+    ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap( NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES );
+    if ( MAP_FAILED == (void *)ring->sqes ) {
+        _tstat_ring_close( ring );
+        return -1;
+    }
+    ring->sq_tail  = (unsigned *)( (char *)ring->sq_ptr + p.sq_off.tail );
+    ring->sq_mask  = (unsigned *)( (char *)ring->sq_ptr + p.sq_off.ring_mask );
+    ring->sq_array = (unsigned *)( (char *)ring->sq_ptr + p.sq_off.array );
+    ring->cq_head  = (unsigned *)( (char *)ring->cq_ptr + p.cq_off.head );
+    ring->cq_tail  = (unsigned *)( (char *)ring->cq_ptr + p.cq_off.tail );
+    ring->cq_mask  = (unsigned *)( (char *)ring->cq_ptr + p.cq_off.ring_mask );
+    ring->cqes     = (struct io_uring_cqe *)
+                        ( (char *)ring->cq_ptr + p.cq_off.cqes );
+    return 0;
+}
+
+int
+_tstat_uring( const char **paths, struct tstat *out, int n )
+{
+    struct tstat_ring ring;
+    struct statx *stx;
+    int done = 0;
+
+    if ( _tstat_ring_open( &ring, TSTAT_RING ) ) {
+        return -1;
+    }
+    stx = malloc( TSTAT_RING * sizeof(struct statx) );
+    if ( !stx ) {
+        _tstat_ring_close( &ring );
+        return -1;
+    }
+    while ( done < n ) {
+        int batch = n - done;
+        int cx;
+        unsigned tail = *ring.sq_tail;
+        /* Each statx is traced from submit to reap, so the slow ones
+         * stand out even though they all went at once */
+        unsigned long long t0 = trace_on() ? trace_ns() : 0;
+        if ( batch > TSTAT_RING ) {
+            batch = TSTAT_RING;
+        }
+        for ( cx = 0; cx < batch; cx++ ) {
+            unsigned slot = ( tail + cx ) & *ring.sq_mask;
+            struct io_uring_sqe *sqe = &ring.sqes[slot];
+            memset( sqe, 0, sizeof(struct io_uring_sqe) );
+            sqe->opcode     = IORING_OP_STATX;
+            sqe->fd         = AT_FDCWD;
+            sqe->addr       = (unsigned long)paths[done + cx];
+            /* Like stat(), follow symlinks */
+            sqe->statx_flags = 0;
+            sqe->len        = STATX_TYPE | STATX_MODE | STATX_INO;
+            sqe->off        = (unsigned long)&stx[cx];
+            sqe->user_data  = cx;
+            ring.sq_array[slot] = slot;
+        }
+        __atomic_store_n( ring.sq_tail, tail + batch, __ATOMIC_RELEASE );
+
+        int submitted = 0;
+        int reaped = 0;
+        while ( reaped < batch ) {
+            int ret = syscall( __NR_io_uring_enter, ring.fd,
+                        batch - submitted, 1, IORING_ENTER_GETEVENTS,
+                        NULL, 0 );
+            if ( 0 > ret ) {
+                if ( EINTR == errno ) {
+                    continue;
+                }
+                /* Some statx may still be in flight, so stx is left
+                 * for the kernel rather than freed. */
+                _tstat_ring_close( &ring );
+                for ( cx = done; cx < n; cx++ ) {
+                    tstat_one( paths[cx], &out[cx] );
+                }
+                return n;
+            }
+            submitted += ret;
+            unsigned head = *ring.cq_head;
+            unsigned ctail = __atomic_load_n( ring.cq_tail, __ATOMIC_ACQUIRE );
+            for ( ; head != ctail; head++ ) {
+                struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+                int ux = (int)cqe->user_data;
+                struct tstat *ts = &out[done + ux];
+                memset( ts, 0, sizeof(struct tstat) );
+                if ( -EINVAL == cqe->res ) {
+                    /* Kernel with io_uring, but older than STATX */
+                    tstat_one( paths[done + ux], ts );
+                }
+                else if ( 0 > cqe->res ) {
+                    ts->ret = -1;
+                    ts->err = -cqe->res;
+                }
+                else {
+                    ts->mode = stx[ux].stx_mode;
+                    ts->ino  = stx[ux].stx_ino;
+                    ts->dev  = makedev( stx[ux].stx_dev_major,
+                                        stx[ux].stx_dev_minor );
+                }
+                if ( t0 ) {
+                    trace_span( "statx", t0, paths[done + ux],
+                        strlen( paths[done + ux] ), ts->err );
+                }
+                reaped++;
+            }
+            __atomic_store_n( ring.cq_head, head, __ATOMIC_RELEASE );
+        }
+        done += batch;
+    }
+    free( stx );
+    _tstat_ring_close( &ring );
+    return n;
+}
+#endif
+
+int
+tstat_batch( const char **paths, struct tstat *out, int n,
+             const struct tstat_how *how )
+{
+    int cx;
+    int jobs = how->jobs;
+
+    if ( ( 0 < how->ttl ) && ( 0 < n ) && ( 0 == scache_open() ) ) {
+        /* Only the misses go on to be looked up, then they are
+         * stored for the next cleanpath. */
+        const char **miss = malloc( n * sizeof(char *) );
+        struct tstat *mout = malloc( n * sizeof(struct tstat) );
+        int *where = malloc( n * sizeof(int) );
+        int nmiss = 0;
+        if ( miss && mout && where ) {
+            for ( cx = 0; cx < n; cx++ ) {
+                if ( !scache_get( paths[cx], &out[cx], how->ttl ) ) {
+                    where[nmiss] = cx;
+                    miss[nmiss++] = paths[cx];
+                }
+                else {
+                    trace_mark( "cached", paths[cx], strlen( paths[cx] ),
+                        out[cx].err );
+                }
+            }
+            struct tstat_how nocache = *how;
+            nocache.ttl = 0;
+            tstat_batch( miss, mout, nmiss, &nocache );
+            for ( cx = 0; cx < nmiss; cx++ ) {
+                out[where[cx]] = mout[cx];
+                scache_put( miss[cx], &mout[cx] );
+            }
+            free( miss );
+            free( mout );
+            free( where );
+            return nmiss;
+        }
+        free( miss );
+        free( mout );
+        free( where );
+    }
+#ifdef HAVE_IO_URING
+    if ( ( how->uring ) && ( 0 < n ) ) {
+        if ( n == _tstat_uring( paths, out, n ) ) {
+            return n;
+        }
+    }
+#endif
+#ifdef HAVE_PTHREAD
+    if ( jobs > n ) {
+        jobs = n;
+    }
+    if ( 1 < jobs ) {
+        struct tstat_work work;
+        pthread_t *tids = malloc( jobs * sizeof(pthread_t) );
+        int started = 0;
+
+        work.paths = paths;
+        work.out   = out;
+        work.n     = n;
+        work.next  = 0;
+        if ( tids ) {
+            /* This thread is one of the jobs */
+            for ( ; started < ( jobs - 1 ); started++ ) {
+                if ( pthread_create( &tids[started], NULL,
+                        _tstat_worker, &work ) )
+                {
+                    break;
+                }
+            }
+            _tstat_worker( &work );
+            for ( cx = 0; cx < started; cx++ ) {
+                pthread_join( tids[cx], NULL );
+            }
+            free( tids );
+            return n;
+        }
+    }
+#endif
+    for ( cx = 0; cx < n; cx++ ) {
+        tstat_one( paths[cx], &out[cx] );
+    }
+    return n;
+}
@@ -0,0 +1,32 @@
+#ifndef VOLLINK_TSTAT_H
+#define VOLLINK_TSTAT_H
+
+#include <sys/types.h>
+
+/* What stat() had to say about one token */
+struct tstat {
+    int     ret;    // 0 or -1, as from stat()
+    int     err;    // errno, if ret is -1
+    mode_t  mode;
+    dev_t   dev;
+    ino_t   ino;
+};
+
+/* How tstat_batch() should go about it */
+struct tstat_how {
+    int     jobs;   // Threads for plain stat(), 1 is serial
+    int     uring;  // Batch statx through io_uring, if it can
+    int     ttl;    // Seconds a shared cache (scache.c) result is good
+};
+
+int     tstat_one( const char *path, struct tstat *ts );
+        // 1 if name in directory dfd is a regular file this user can
+        // run, as the shell would see it.  type is readdir()'s d_type,
+        // with DT_REG it costs one access() rather than a stat() too.
+int     tstat_command( int dfd, const char *name, int type );
+        // stat() paths[0..n) into out[0..n)
+        // Returns the number of paths actually looked up (cache misses)
+int     tstat_batch( const char **paths, struct tstat *out, int n,
+                     const struct tstat_how *how );
+
+#endif